@@ -1,7 +1,29 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <iostream>
-#include <map>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 
 using namespace std;
@@ -11,32 +33,52 @@ using namespace std;
 // Account Number ADT
 //***********************
 
-class AccountNo {                       /* Value range: 0001-9999 */
+class AccountNo {                       /* Value range: 0001-999999999999999999 (64-bit)           */
 public:
-    AccountNo ();                       /* New account number                          */
-    explicit AccountNo ( int number );  /* Existing account number (for lookups)       */
-    int number () const;                /* Accessor -- integer value of account number */
+    AccountNo ();                       /* New account number                                      */
+    explicit AccountNo ( long long number ); /* Existing account number (for lookups)               */
+    long long number () const;          /* Accessor -- integer value of account number             */
+    static bool valid ( long long );    /* Accessor -- true if the integer is a legal account number */
+    struct Allocator {                  /* State of the number allocator, as seen by this thread    */
+        long long nextBlock, blockNext, blockEnd;
+    };
+    static Allocator allocator ();      /* Accessor -- allocator state (for checkpoints)            */
+    static void allocatorIs ( const Allocator& ); /* Mutator -- restores allocator state            */
+    static bool valid ( const Allocator&, long long accounts ); /* Accessor -- true if the state could have numbered the accounts */
+    static long long next ();           /* Accessor -- number this thread's next new account number will have */
 private:
-    int number_;
-    static int next_;
-    static int const maxVal_ = 9999;
+    long long number_;
+    static atomic<long long> nextBlock_;            /* first number of the next unclaimed block     */
+    static thread_local long long blockNext_;       /* next number in this thread's claimed block   */
+    static thread_local long long blockEnd_;        /* one past the last number of the claimed block */
+    static long long const blockSize_ = 64;
+    static long long const maxVal_ = 999999999999999999LL;
 };
 
 
-// initialization of static data member to the lowest legal value
-int AccountNo::next_ = 1;
+// initialization of static data members -- the first block starts at the lowest legal value,
+// and no thread holds a block until its first new account number
+atomic<long long> AccountNo::nextBlock_( 1 );
+thread_local long long AccountNo::blockNext_ = 0;
+thread_local long long AccountNo::blockEnd_ = 0;
 
 
-// constructor -- constructs a new unique account number
+// constructor -- constructs a new unique account number.  Each thread claims a block of
+// blockSize_ numbers with one atomic add and then hands them out without synchronization,
+// so a single thread still numbers its accounts 1, 2, 3, ...
 AccountNo::AccountNo () {
-    if ( next_ > maxVal_ )
+    if ( blockNext_ == blockEnd_ ) {
+        blockNext_ = nextBlock_.fetch_add( blockSize_ );
+        blockEnd_ = blockNext_ + blockSize_;
+    }
+    if ( blockNext_ > maxVal_ )
         exit (1);
-    number_ = next_++;
+    number_ = blockNext_++;
 }
 
 // constructor -- converts an integer into an account number
 // REQUIRES:  number corresponds to an existing account number
-AccountNo::AccountNo ( int number ) {
+AccountNo::AccountNo ( long long number ) {
     if ( (number > maxVal_) || (number < 1) )
         exit(1);
     number_ = number;
@@ -44,10 +86,42 @@ AccountNo::AccountNo ( int number ) {
 
 
 // accessor - returns account number value of object
-int AccountNo::number() const {
+long long AccountNo::number() const {
     return number_;
 }
 
+// accessor - returns true if the integer is in the range of account numbers, so AccountNo(number) is safe
+bool AccountNo::valid(long long number) {
+    return number >= 1 && number <= maxVal_;
+}
+
+// accessor - returns the shared block counter and this thread's claimed block
+AccountNo::Allocator AccountNo::allocator() {
+    Allocator state = { nextBlock_.load(), blockNext_, blockEnd_ };
+    return state;
+}
+
+// mutator - restores the shared block counter and this thread's claimed block, so numbering
+// continues where the saved allocator left off
+void AccountNo::allocatorIs(const Allocator &state) {
+    nextBlock_.store( state.nextBlock );
+    blockNext_ = state.blockNext;
+    blockEnd_ = state.blockEnd;
+}
+
+
+// accessor - returns the number the next AccountNo() made by this thread will have, without claiming it
+long long AccountNo::next() {
+    return ( blockNext_ != blockEnd_ ) ? blockNext_ : nextBlock_.load();
+}
+
+// accessor - returns true if the allocator state is consistent and could have numbered that many accounts.
+// Every block is claimed for a new account number, so no more blocks are claimed than accounts opened.
+bool AccountNo::valid(const Allocator &state, long long accounts) {
+    return state.nextBlock >= 1 && state.nextBlock - 1 <= blockSize_*accounts &&
+           state.blockNext >= 0 && state.blockNext <= state.blockEnd && state.blockEnd <= state.nextBlock;
+}
+
 
 // comparison operators
 bool operator== (const AccountNo &a, const AccountNo &b) {
@@ -77,7 +151,7 @@ bool operator>= (const AccountNo &a, const AccountNo &b) {
 
 // streaming operators
 istream& operator>> ( istream &sin, AccountNo &a ) {
-    int number;
+    long long number;
     sin >> number;
     a = AccountNo(number);
 
@@ -95,264 +169,3598 @@ ostream& operator<< ( ostream &sout, const AccountNo &a ) {
 
 
 //*******************
-// Account
+// CallHistory
 //*******************
 
-class Account {
-public:                                         // PUBLIC interface of Account
-    explicit Account( const AccountNo& );           // constructor
-    virtual ~Account() {}                           // destructor
-    int balance () const;                           // accessor - returns balance as an integer
-    virtual void call ( int duration ) = 0;         // records information about a call (e.g., duration of call in minutes)
-    virtual void bill () = 0;                       // decrements balance by monthly fee and the cost of using extra minutes
-    void pay (int amount);                          // increments balance by amount paid
-    virtual void print() const;                     // prints information about the account (e.g., account number, balance, minutes used this month)
-protected:
-    void balanceIs( const int );                    // mutator - changes balance of the account
+class CallHistory {                             // Per-row call detail records in compact columnar segments
+public:
+    class Cursor {                                  // Streams the calls of one row, oldest first
+    public:
+        Cursor( const CallHistory&, int row );      // constructor -- starts at the first call of the row
+        bool next( long long &time, int &duration );// mutator - reads the next call; false after the last one
+    private:
+        const CallHistory *history_;
+        int segment_;                               // segment being read, or -1 at the end
+        int call_;                                  // calls of the segment already read
+        int timeAt_, durationAt_;                   // read positions in the segment's two columns
+        long long time_;                            // time of the previous call, the base of the next delta
+    };
+    static int const columnBytes_ = 56;             // bytes of each column in a segment, 120-byte segments in all
+    struct Segment {                                // calls of one row, each column encoded on its own
+        int next;                                   // following segment of the row, or -1
+        unsigned short calls;
+        unsigned char timeBytes, durationBytes;     // bytes used in each column
+        unsigned char time[columnBytes_];           // zigzag varint seconds since the previous call of the row
+        unsigned char duration[columnBytes_];       // zigzag varint minutes of each call
+    };
+    struct Chain {                                  // segments of one row
+        int head, tail;                             // first and last segment, or -1 if the row has no calls
+        long long lastTime;                         // time of the last call, the base of the next delta
+        long long calls;
+    };
+    CallHistory();                                  // constructor
+    void addRow();                                  // mutator - appends a row with no calls
+    void append( int row, long long time, int duration ); // mutator - records a call of the row
+    long long calls( int row ) const;               // accessor - number of calls recorded for the row
+    size_t bytes() const;                           // accessor - storage held by the segments
+    void clear();                                   // mutator - removes every row and call
+    const vector<Chain>& chains() const;            // accessor - chain of each row (for checkpoints)
+    const vector<Segment>& segments() const;        // accessor - segments of every row (for checkpoints)
+    void segmentsIs( vector<Chain>&, vector<Segment>& ); // mutator - takes over chains and segments saved from chains() and segments()
+    static bool valid( const vector<Chain>&, const vector<Segment>& ); // accessor - true if the chains and segments are a history
 private:
-    AccountNo const accountNo_;
-    int balance_;
+    static int encode( long long, unsigned char* ); // writes a zigzag varint, returns its length
+    static long long decode( const unsigned char*, int &at ); // reads a zigzag varint at position at, advancing it
+    static bool validColumn( const unsigned char*, int bytes, int calls, unsigned long long &sum ); // true if the bytes hold calls varints
+    vector<Segment> segments_;                      // segments of every row, linked by index so they may move
+    vector<Chain> chains_;                          // chains_[row] is the chain of the row
 };
 
-// constructor -- constructs a new account with an automatically generated account number and a balance of zero
-Account::Account(const AccountNo &accountNo) : accountNo_(accountNo), balance_(0) { }
 
-// accessor - returns balance value of object
-int Account::balance() const {
-    return balance_;
+// constructor -- constructs an empty history
+CallHistory::CallHistory() { }
+
+// mutator - appends a row with no calls
+void CallHistory::addRow() {
+    Chain chain = { -1, -1, 0, 0 };
+    chains_.push_back(chain);
 }
 
-// increments balance value of object by the amount
-void Account::pay(int amount) {
-    balance_ += amount;
+// mutator - appends the call to the last segment of the row, starting a new segment when either column
+// is full.  The time is stored as the difference from the row's previous call, so a call costs a few bytes.
+void CallHistory::append(int row, long long time, int duration) {
+    Chain &chain = chains_[row];
+    unsigned char timeCode[10], durationCode[10];
+    int timeLength = encode( time - chain.lastTime, timeCode );
+    int durationLength = encode( duration, durationCode );
+
+    if ( chain.tail < 0 || segments_[chain.tail].timeBytes + timeLength > columnBytes_ ||
+         segments_[chain.tail].durationBytes + durationLength > columnBytes_ ) {
+        Segment segment;
+        memset( &segment, 0, sizeof(segment) );    // the unused bytes are written to checkpoints as well
+        segment.next = -1;
+        segments_.push_back(segment);
+        int added = (int)segments_.size() - 1;
+        if ( chain.tail < 0 )
+            chain.head = added;
+        else
+            segments_[chain.tail].next = added;
+        chain.tail = added;
+    }
+
+    Segment &segment = segments_[chain.tail];
+    memcpy( segment.time + segment.timeBytes, timeCode, timeLength );
+    memcpy( segment.duration + segment.durationBytes, durationCode, durationLength );
+    segment.timeBytes += timeLength;
+    segment.durationBytes += durationLength;
+    segment.calls++;
+    chain.lastTime = time;
+    chain.calls++;
 }
 
-// prints the account number and balance values of the object
-void Account::print() const {
-    cout << "  Account Number = " << accountNo_ << endl;
-    cout << "  Balance = " << (balance_ < 0 ? "-" : "") << "$" << abs(balance_) << endl;
+// accessor - returns number of calls recorded for the row
+long long CallHistory::calls(int row) const {
+    return chains_[row].calls;
+}
+
+// accessor - returns the bytes of segment storage in use
+size_t CallHistory::bytes() const {
+    return segments_.size()*sizeof(Segment);
+}
+
+// mutator - removes every row and its calls
+void CallHistory::clear() {
+    segments_.clear();
+    chains_.clear();
+}
+
+// accessor - returns the chain of each row, in row order
+const vector<CallHistory::Chain>& CallHistory::chains() const {
+    return chains_;
+}
+
+// accessor - returns the segments the chains link
+const vector<CallHistory::Segment>& CallHistory::segments() const {
+    return segments_;
+}
+
+// mutator - replaces every row and call with the chains and segments, taking over their storage and
+// leaving both vectors empty
+// REQUIRES: valid() accepts the chains and segments
+void CallHistory::segmentsIs(vector<Chain> &chains, vector<Segment> &segments) {
+    chains_.swap( chains );
+    segments_.swap( segments );
+    chains.clear();
+    segments.clear();
+}
+
+// accessor - returns true if every segment is on exactly one chain, each chain ends at its tail, and the
+// columns of each segment decode within their bytes to as many calls as the segment and its chain record,
+// with the time deltas of the chain adding up to its last time.  Cursor and append() rely on all of it.
+bool CallHistory::valid(const vector<Chain> &chains, const vector<Segment> &segments) {
+    vector<char> linked( segments.size(), false );
+    for ( vector<Chain>::size_type row = 0; row < chains.size(); row++ ) {
+        const Chain &chain = chains[row];
+        unsigned long long time = 0, durations = 0;
+        long long calls = 0;
+        int last = -1;
+        for ( int at = chain.head; at >= 0; at = segments[at].next ) {
+            if ( at >= (int)segments.size() || linked[at] )
+                return false;
+            linked[at] = true;
+            const Segment &segment = segments[at];
+            if ( segment.calls == 0 || !validColumn( segment.time, segment.timeBytes, segment.calls, time ) ||
+                 !validColumn( segment.duration, segment.durationBytes, segment.calls, durations ) )
+                return false;
+            calls += segment.calls;
+            last = at;
+        }
+        if ( last != chain.tail || calls != chain.calls || (long long)time != chain.lastTime )
+            return false;
+    }
+    return find( linked.begin(), linked.end(), false ) == linked.end();
+}
+
+// returns true if the first bytes of the column hold exactly calls varints, none longer than encode()
+// writes, and adds their values to sum
+bool CallHistory::validColumn(const unsigned char *column, int bytes, int calls, unsigned long long &sum) {
+    if ( bytes > columnBytes_ )
+        return false;
+    int at = 0;
+    for ( int call = 0; call < calls; call++ ) {
+        int start = at;
+        while ( at < bytes && at - start < 10 && ( column[at] & 0x80 ) )
+            at++;
+        if ( at == bytes || at - start == 10 )
+            return false;
+        at = start;
+        sum += (unsigned long long)decode( column, at );
+    }
+    return at == bytes;
+}
+
+// writes the value zigzag encoded (so small negative values stay short), 7 bits to a byte, low bits first
+int CallHistory::encode(long long value, unsigned char *out) {
+    unsigned long long bits = ( (unsigned long long)value << 1 ) ^ (unsigned long long)( value >> 63 );
+    int length = 0;
+    while ( bits >= 0x80 ) {
+        out[length++] = (unsigned char)( bits | 0x80 );
+        bits >>= 7;
+    }
+    out[length++] = (unsigned char)bits;
+    return length;
+}
+
+// inverse of encode()
+long long CallHistory::decode(const unsigned char *in, int &at) {
+    unsigned long long bits = 0;
+    int shift = 0;
+    while ( in[at] & 0x80 ) {
+        bits |= (unsigned long long)( in[at++] & 0x7f ) << shift;
+        shift += 7;
+    }
+    bits |= (unsigned long long)in[at++] << shift;
+    return (long long)( bits >> 1 ) ^ -(long long)( bits & 1 );
 }
 
-// mutator - changes the balance value of object to the new balance
-void Account::balanceIs(const int newBalance) {
-    balance_ = newBalance;
+// constructor -- constructs a cursor before the first call of the row
+CallHistory::Cursor::Cursor(const CallHistory &history, int row) : history_(&history), segment_(history.chains_[row].head), call_(0), timeAt_(0), durationAt_(0), time_(0) { }
+
+// mutator - decodes the next call of the row into time and duration
+// RETURNS: false, leaving time and duration unchanged, if every call has been read
+bool CallHistory::Cursor::next(long long &time, int &duration) {
+    while ( segment_ >= 0 && call_ == history_->segments_[segment_].calls ) {
+        segment_ = history_->segments_[segment_].next;
+        call_ = timeAt_ = durationAt_ = 0;
+    }
+    if ( segment_ < 0 )
+        return false;
+    const Segment &segment = history_->segments_[segment_];
+    time_ += decode( segment.time, timeAt_ );
+    time = time_;
+    duration = (int)decode( segment.duration, durationAt_ );
+    call_++;
+    return true;
 }
 
 
 //*******************
-// CheapAccount
+// AccountColumns
 //*******************
 
-class CheapAccount : public Account {           //  Derived class of Account for Cheap Plan
+class AccountColumns {                          // Column store of balances and minutes for the accounts of one plan
 public:
-    explicit CheapAccount( const AccountNo& );      // constructor
-    void call( int duration );                      // records information about a call (e.g., duration of call in minutes)
-    void bill();                                    // decrements balance by monthly fee and the cost of using extra minutes
-    void print() const;                             // prints information about the Cheap Plan Account (e.g., account number, balance, minutes used this month)
+    typedef vector< pair<int,int> > BalanceIndex;   // (stored balance, row) of every row, lowest balance first
+    AccountColumns();                               // constructor
+    int addRow();                                   // mutator - appends a row with zero balance and minutes, returns its index
+    int rows() const;                               // accessor - number of rows in the columns
+    int balanceAt( int row ) const;                 // accessor - balance of the row
+    void balanceAtIs( int row, int balance );       // mutator - changes balance of the row
+    int minutesAt( int row ) const;                 // accessor - minutes of the row
+    void addMinutes( int row, int minutes );        // mutator - records minutes of calls, marking the row active
+    int activeRows() const;                         // accessor - number of rows with calls this cycle
+    const int* active() const;                      // accessor - indexes of the rows with calls this cycle
+    void charge( int amount );                      // mutator - deducts the amount from every balance at once
+    void closeCycle();                              // mutator - starts a new cycle with no active rows
+    int charged() const;                            // accessor - total of the charges deducted by charge()
+    void chargedIs( int );                          // mutator - changes the total of the charges (for checkpoints)
+    int* balances();                                // accessor - start of the stored balance column (for kernels)
+    const int* balances() const;
+    int* minutes();                                 // accessor - start of the minutes column (for kernels)
+    const int* minutes() const;
+    void addBalances( const int* deltas );          // mutator - adds a column of deltas to the balances
+    void load( const int* balances, const int* minutes ); // mutator - overwrites every row from saved columns
+    void clear();                                   // mutator - removes every row
+    const BalanceIndex& byBalance() const;          // accessor - index of the rows by balance, brought up to date first
+    long long totalBalance() const;                 // accessor - sum of the balances of every row
+    CallHistory& history();                         // accessor - call detail records of the rows
+    const CallHistory& history() const;
+    int cycles() const;                             // accessor - number of billing cycles closed
+    bool balanceAsOf( int row, int cycle, int &balance ) const; // accessor - balance of the row at the close of the cycle
+    long long cycleRecords() const;                 // accessor - number of stored balances kept for balanceAsOf()
+    void cycleHistory( vector<int>& ) const;        // accessor - appends the cycle history as ints (for checkpoints)
+    void cycleHistoryIs( const int*, int cycles, long long records ); // mutator - replaces the cycle history with one saved by cycleHistory()
+    static bool validCycleHistory( const int*, int rows, int cycles, long long records ); // accessor - true if the ints are a cycle history
 private:
-    int minutes_;
-    static int const monthlyCharge_ = 30;
-    static int const freeMinutes_ = 200;
-    static int const chargePerMinute_ = 1;
+    struct CycleBalance {                           // stored balance of a row from the close of a cycle on
+        int previous;                               // record of the row made before this one, or -1
+        int cycle;
+        int stored;
+    };
+    AccountColumns( const AccountColumns& );        // copying is prohibited
+    AccountColumns& operator= ( const AccountColumns& );
+    void stale( int row );                          // marks the row's place in the index out of date
+    void refreshIndex() const;                      // moves the rows marked stale to the places of their stored balances
+    void changed( int row );                        // marks the row's stored balance changed this cycle
+    void recordCycle( int row );                    // records the row's stored balance at the close of this cycle
+    vector<int> balance_;                           // balance of each row plus charged_
+    vector<int> minutes_;
+    vector<char> isActive_;                         // isActive_[row] is true if the row is in active_
+    vector<int> active_;                            // rows with calls this cycle, in order of first call
+    int charged_;                                   // charges applied to every row, not yet folded into balance_
+    mutable BalanceIndex index_;                    // sorted; charge() lowers every balance equally, so it keeps this order
+    mutable vector<int> indexed_;                   // stored balance of each row as recorded in index_
+    mutable long long indexedTotal_;                // sum of indexed_
+    mutable vector<char> isStale_;                  // isStale_[row] is true if the row is in stale_
+    mutable vector<int> stale_;                     // rows whose stored balance may differ from indexed_
+    CallHistory history_;
+    vector<char> isChanged_;                        // isChanged_[row] is true if the row is in changed_
+    vector<int> changed_;                           // rows paid this cycle, whose stored balance changed
+    vector<CycleBalance> cycleBalances_;            // records of every row, in the order they were made
+    vector<int> lastCycleBalance_;                  // lastCycleBalance_[row] is the row's latest record, or -1
+    vector<int> chargedAt_;                         // chargedAt_[n-1] is charged_ at the close of cycle n
 };
 
-// constructor -- constructs a new Cheap Account with a base Account object and a balance of zero
-CheapAccount::CheapAccount(const AccountNo &accountNo) : Account(accountNo), minutes_(0) { }
 
-// increments the minute value of object by duration of call
-void CheapAccount::call(int duration) {
-    minutes_ += duration;
+// constructor -- constructs empty columns
+AccountColumns::AccountColumns() : charged_(0), indexedTotal_(0) { }
+
+// mutator - appends a row with zero balance and zero minutes
+int AccountColumns::addRow() {
+    balance_.push_back(charged_);
+    minutes_.push_back(0);
+    isActive_.push_back(false);
+    indexed_.push_back(0);
+    isStale_.push_back(false);
+    stale( rows() - 1 );
+    history_.addRow();
+    isChanged_.push_back(false);
+    lastCycleBalance_.push_back(-1);
+    recordCycle( rows() - 1 );
+    return rows() - 1;
+}
+
+// accessor - returns number of rows
+int AccountColumns::rows() const {
+    return (int)balance_.size();
+}
+
+// accessor - returns balance value of the row, folding in the charges applied to every row
+int AccountColumns::balanceAt(int row) const {
+    return balance_[row] - charged_;
+}
+
+// mutator - changes balance value of the row
+void AccountColumns::balanceAtIs(int row, int balance) {
+    balance_[row] = balance + charged_;
+    stale(row);
+    changed(row);
+}
+
+// accessor - returns minutes value of the row
+int AccountColumns::minutesAt(int row) const {
+    return minutes_[row];
+}
+
+// mutator - increments minutes value of the row and adds the row to the active rows of the cycle
+void AccountColumns::addMinutes(int row, int minutes) {
+    minutes_[row] += minutes;
+    if ( !isActive_[row] ) {
+        isActive_[row] = true;
+        active_.push_back(row);
+    }
+}
+
+// accessor - returns number of active rows
+int AccountColumns::activeRows() const {
+    return (int)active_.size();
+}
+
+// accessor - returns the active rows, or NULL if there are none
+const int* AccountColumns::active() const {
+    return active_.empty() ? NULL : &active_[0];
+}
+
+// mutator - deducts the amount from the balance of every row by raising the charges folded into
+// balanceAt(), without touching the rows
+void AccountColumns::charge(int amount) {
+    charged_ += amount;
+}
+
+// mutator - marks stale the index entries of the active rows, whose balances the billing kernels
+// changed in place, records the stored balance of every row changed this cycle, and clears the active rows
+void AccountColumns::closeCycle() {
+    for ( vector<int>::size_type i = 0; i < active_.size(); i++ ) {
+        stale(active_[i]);
+        recordCycle(active_[i]);
+        isActive_[active_[i]] = false;
+    }
+    active_.clear();
+    for ( vector<int>::size_type i = 0; i < changed_.size(); i++ ) {
+        recordCycle(changed_[i]);
+        isChanged_[changed_[i]] = false;
+    }
+    changed_.clear();
+    chargedAt_.push_back(charged_);
+}
+
+// accessor - returns charged value of object
+int AccountColumns::charged() const {
+    return charged_;
+}
+
+// mutator - changes charged value of object
+void AccountColumns::chargedIs(int charged) {
+    charged_ = charged;
+}
+
+// accessor - returns the balance column, or NULL if there are no rows.  Stored balances include charged().
+int* AccountColumns::balances() {
+    return balance_.empty() ? NULL : &balance_[0];
+}
+
+const int* AccountColumns::balances() const {
+    return balance_.empty() ? NULL : &balance_[0];
+}
+
+// accessor - returns the minutes column, or NULL if there are no rows
+int* AccountColumns::minutes() {
+    return minutes_.empty() ? NULL : &minutes_[0];
+}
+
+const int* AccountColumns::minutes() const {
+    return minutes_.empty() ? NULL : &minutes_[0];
+}
+
+// mutator - copies stored balances[i] and minutes[i] into row i, for every row, and marks the rows
+// with minutes active.  The balance history starts over from the loaded balances, unless
+// cycleHistoryIs() restores it.
+void AccountColumns::load(const int *balances, const int *minutes) {
+    copy( balances, balances + rows(), balance_.begin() );
+    copy( minutes, minutes + rows(), minutes_.begin() );
+    for ( int row = 0; row < rows(); row++ )
+        stale(row);
+    closeCycle();
+    chargedAt_.clear();
+    cycleBalances_.clear();
+    lastCycleBalance_.assign( rows(), -1 );
+    for ( int row = 0; row < rows(); row++ )
+        recordCycle(row);
+    for ( int row = 0; row < rows(); row++ ) {
+        if ( minutes_[row] != 0 ) {
+            isActive_[row] = true;
+            active_.push_back(row);
+        }
+    }
+}
+
+// mutator - removes every row
+void AccountColumns::clear() {
+    balance_.clear();
+    minutes_.clear();
+    isActive_.clear();
+    active_.clear();
+    charged_ = 0;
+    index_.clear();
+    indexed_.clear();
+    indexedTotal_ = 0;
+    isStale_.clear();
+    stale_.clear();
+    history_.clear();
+    isChanged_.clear();
+    changed_.clear();
+    cycleBalances_.clear();
+    lastCycleBalance_.clear();
+    chargedAt_.clear();
+}
+
+// mutator - adds deltas[i] to the balance of row i, for every row
+void AccountColumns::addBalances(const int *deltas) {
+    int n = rows();
+    int* __restrict balance = balances();
+    for (int i = 0; i < n; i++) {
+        balance[i] += deltas[i];
+    }
+    for (int i = 0; i < n; i++) {
+        if ( deltas[i] != 0 ) {
+            stale(i);
+            changed(i);
+        }
+    }
+}
+
+// accessor - returns the index of the rows by stored balance.  Every stored balance is its
+// balance plus charged(), so the order is also the order of the balances.
+const AccountColumns::BalanceIndex& AccountColumns::byBalance() const {
+    refreshIndex();
+    return index_;
+}
+
+// accessor - returns the sum of the balances of the rows, as maintained with the index
+long long AccountColumns::totalBalance() const {
+    refreshIndex();
+    return indexedTotal_ - (long long)rows()*charged_;
+}
+
+// accessor - returns the call detail records of the rows
+CallHistory& AccountColumns::history() {
+    return history_;
+}
+
+const CallHistory& AccountColumns::history() const {
+    return history_;
+}
+
+// accessor - returns number of billing cycles closed
+int AccountColumns::cycles() const {
+    return (int)chargedAt_.size();
+}
+
+// accessor - finds the stored balance of the row at the close of the cycle by walking back from the
+// row's latest record to the last one made by that close, and takes off the charges of every row as
+// they were at that close.  The cost is the number of cycles since then that changed the row.
+// A cycle not yet closed gives the current balance.
+// RETURNS: false if the row was opened after the cycle closed
+bool AccountColumns::balanceAsOf(int row, int cycle, int &balance) const {
+    if ( cycle > cycles() ) {
+        balance = balanceAt(row);
+        return true;
+    }
+    int at = lastCycleBalance_[row];
+    while ( at >= 0 && cycleBalances_[at].cycle > cycle )
+        at = cycleBalances_[at].previous;
+    if ( at < 0 )
+        return false;
+    balance = cycleBalances_[at].stored - chargedAt_[cycle - 1];
+    return true;
+}
+
+// accessor - returns number of stored balances recorded in the cycle history of every row
+long long AccountColumns::cycleRecords() const {
+    return cycleBalances_.size();
+}
+
+// accessor - appends the cycle history: the charges at the close of each cycle, the latest record of
+// each row, then the previous record, cycle and stored balance of each record, in the order made
+void AccountColumns::cycleHistory(vector<int> &out) const {
+    out.insert( out.end(), chargedAt_.begin(), chargedAt_.end() );
+    out.insert( out.end(), lastCycleBalance_.begin(), lastCycleBalance_.end() );
+    for ( vector<CycleBalance>::size_type i = 0; i < cycleBalances_.size(); i++ ) {
+        out.push_back( cycleBalances_[i].previous );
+        out.push_back( cycleBalances_[i].cycle );
+        out.push_back( cycleBalances_[i].stored );
+    }
+}
+
+// mutator - replaces the cycle history of every row with one appended by cycleHistory() for as many
+// rows, cycles and records.  A row whose stored balance is not the one last recorded is marked changed,
+// so the close of the open cycle records it.
+// REQUIRES: validCycleHistory() accepts the ints
+void AccountColumns::cycleHistoryIs(const int *in, int cycles, long long records) {
+    chargedAt_.assign( in, in + cycles );
+    lastCycleBalance_.assign( in + cycles, in + cycles + rows() );
+    const int *record = in + cycles + rows();
+    cycleBalances_.resize( records );
+    for ( long long i = 0; i < records; i++, record += 3 ) {
+        CycleBalance saved = { record[0], record[1], record[2] };
+        cycleBalances_[i] = saved;
+    }
+    for ( int row = 0; row < rows(); row++ ) {
+        int last = lastCycleBalance_[row];
+        if ( last < 0 || cycleBalances_[last].stored != balance_[row] )
+            changed(row);
+    }
+}
+
+// accessor - returns true if the ints hold a cycle history of the rows and cycles with that many records:
+// every record is on the chain of exactly one row, and walking back along each chain the cycles fall
+// from at most one past the last cycle closed to at least 1
+bool AccountColumns::validCycleHistory(const int *in, int rows, int cycles, long long records) {
+    const int *last = in + cycles;
+    const int *record = last + rows;
+    vector<char> linked( records, false );
+    for ( int row = 0; row < rows; row++ ) {
+        int bound = cycles + 1;
+        for ( int at = last[row]; at >= 0; at = record[3*(long long)at] ) {
+            if ( at >= records || linked[at] )
+                return false;
+            linked[at] = true;
+            int cycle = record[3*(long long)at + 1];
+            if ( cycle < 1 || cycle > bound )
+                return false;
+            bound = cycle - 1;
+        }
+    }
+    return find( linked.begin(), linked.end(), false ) == linked.end();
+}
+
+// adds the row to the rows whose stored balance changed this cycle
+void AccountColumns::changed(int row) {
+    if ( !isChanged_[row] ) {
+        isChanged_[row] = true;
+        changed_.push_back(row);
+    }
+}
+
+// records the stored balance of the row as of the close of the cycle in progress, replacing a record
+// already made for that cycle.  Nothing is added if the stored balance is the one last recorded.
+// Records of every row go to the end of one array, so recording never allocates per row.
+void AccountColumns::recordCycle(int row) {
+    int last = lastCycleBalance_[row];
+    if ( last >= 0 && cycleBalances_[last].cycle == cycles() + 1 )
+        cycleBalances_[last].stored = balance_[row];
+    else if ( last < 0 || cycleBalances_[last].stored != balance_[row] ) {
+        CycleBalance record = { last, cycles() + 1, balance_[row] };
+        cycleBalances_.push_back(record);
+        lastCycleBalance_[row] = (int)cycleBalances_.size() - 1;
+    }
+}
+
+// adds the row to the rows whose index entry is brought up to date by the next query, so a change of
+// balance costs a flag test rather than an update of the index
+void AccountColumns::stale(int row) {
+    if ( !isStale_[row] ) {
+        isStale_[row] = true;
+        stale_.push_back(row);
+    }
 }
 
-// decrements balance value of object by monthlyCharge and the cost of using extra minutes,
-// and changes the minutes value of object to zero
-void CheapAccount::bill() {
-    int newBalance = Account::balance() - monthlyCharge_;
-    if (minutes_ > freeMinutes_) {
-        newBalance -= (minutes_ - freeMinutes_)*chargePerMinute_;
+// moves the rows marked stale to the places of their stored balances: their entries are dropped in one
+// pass, new ones are sorted and merged back in, so the cost is linear in the rows plus k log k for k
+// stale rows.  Rows added since the last refresh have no entry yet and indexed_ of zero.
+void AccountColumns::refreshIndex() const {
+    if ( stale_.empty() )
+        return;
+    BalanceIndex::size_type kept = 0;
+    for ( BalanceIndex::size_type i = 0; i < index_.size(); i++ ) {
+        if ( !isStale_[index_[i].second] )
+            index_[kept++] = index_[i];
+    }
+    index_.resize(kept);
+    for ( vector<int>::size_type i = 0; i < stale_.size(); i++ ) {
+        int row = stale_[i];
+        index_.push_back( make_pair( balance_[row], row ) );
+        indexedTotal_ += balance_[row] - indexed_[row];
+        indexed_[row] = balance_[row];
+        isStale_[row] = false;
     }
-    Account::balanceIs(newBalance);
-    minutes_ = 0;
+    stale_.clear();
+    sort( index_.begin() + kept, index_.end() );
+    inplace_merge( index_.begin(), index_.begin() + kept, index_.end() );
 }
 
-// prints type of account, information about the base account object and minutes value of the object
-void CheapAccount::print() const {
-    cout << "CheapAccount:" << endl;
-    Account::print();
-    cout << "  Minutes = " << minutes_ << endl;
+
+//*******************
+// Tariffs
+//*******************
+
+enum Plan { CheapPlan, ExpensivePlan, NumPlans };   // phone-service plans offered
+
+// A tariff is a compile-time description of a plan.  To add a plan, declare its tariff here, add
+// its Plan value above and its case to dispatch() below; nothing else needs a new class.
+
+struct CheapTariff {                            // Cheap Plan -- monthly fee, free minutes, then a charge per extra minute
+    static bool const metered = true;               // minutes of calls are recorded and billed
+    static int const monthlyCharge = 30;
+    static int const freeMinutes = 200;
+    static int const chargePerMinute = 1;
+    static const char* name() { return "Cheap"; }
+};
+
+struct ExpensiveTariff {                        // Expensive Plan -- monthly fee only, calls are free
+    static bool const metered = false;
+    static int const monthlyCharge = 100;
+    static int const freeMinutes = 0;
+    static int const chargePerMinute = 0;
+    static const char* name() { return "Expensive"; }
+};
+
+
+// calls op.apply<Tariff>() with the tariff of the plan.  This is the one place that lists every plan;
+// everything else is written once against a Tariff and specialized by the compiler.
+template <class Op>
+inline void dispatch( Plan plan, Op &op ) {
+    switch ( plan ) {
+        case CheapPlan: op.template apply<CheapTariff>(); break;
+        case ExpensivePlan: op.template apply<ExpensiveTariff>(); break;
+        default: break;
+    }
 }
 
 
 //*******************
-// ExpensiveAccount
+// TariffPlan
 //*******************
 
-class ExpensiveAccount : public Account {           // Derived class of Account for Expensive Plan
+template <class Tariff>
+class TariffPlan {                              // Call and billing rules of a tariff, applied to rows of its plan's column store
 public:
-    explicit ExpensiveAccount( const AccountNo& );      // constructor
-    void call( int duration ) {}                        // records information about a call
-    void bill();                                        // decrements balance by monthly fee
-    void print() const;                                 // prints information about the Expensive Plan Account (e.g., account number, balance)
-private:
-    static int const monthlyCharge_ = 100;
+    static void call( AccountColumns&, int row, int duration ); // records a call against the row
+    static void billRange( AccountColumns&, int, int );         // bills the extra minutes of active rows [begin, end)
+    static void closeCycle( AccountColumns& );                  // charges every row the monthly fee, ending the cycle
+    static void callAll( AccountColumns&, const int* );         // records a column of call minutes against every row
+    static int cycleCharge( int minutes );                      // charge for a cycle with the minutes of calls
 };
 
-// constructor - constructs a new Expensive Account with a base Account object
-ExpensiveAccount::ExpensiveAccount(const AccountNo &accountNo) : Account(accountNo) { }
 
-// decrements balance value of object by monthlyCharge,
-// and changes the minutes value of object to zero
-void ExpensiveAccount::bill() {
-    Account::balanceIs(Account::balance() - monthlyCharge_);
+// increments the minutes of the row by the duration of the call, if the tariff meters minutes
+template <class Tariff>
+inline void TariffPlan<Tariff>::call(AccountColumns &columns, int row, int duration) {
+    if ( Tariff::metered )
+        columns.addMinutes( row, duration );
 }
 
-// prints type of account and information about the base account object
-void ExpensiveAccount::print() const {
-    cout << "ExpensiveAccount:" << endl;
-    Account::print();
+// bills entries [begin, end) of the active rows -- the only rows with minutes -- for their extra
+// minutes and changes their minutes to zero.  Together with closeCycle() this bills every row, at a
+// cost proportional to the rows that made calls.
+template <class Tariff>
+void TariffPlan<Tariff>::billRange(AccountColumns &columns, int begin, int end) {
+    if ( !Tariff::metered )
+        return;
+    const int* active = columns.active();
+    int* __restrict balance = columns.balances();
+    int* __restrict minutes = columns.minutes();
+    for (int i = begin; i < end; i++) {
+        int row = active[i];
+        int extra = minutes[row] - Tariff::freeMinutes;
+        extra = extra > 0 ? extra : 0;
+        balance[row] -= extra*Tariff::chargePerMinute;
+        minutes[row] = 0;
+    }
 }
 
+// deducts the monthly charge from every row in constant time and clears the active rows
+template <class Tariff>
+inline void TariffPlan<Tariff>::closeCycle(AccountColumns &columns) {
+    columns.charge( Tariff::monthlyCharge );
+    columns.closeCycle();
+}
 
-//************************************************************************
-//  Helper variables and functions for test harness
-//************************************************************************
+// returns the monthly charge plus the cost of the minutes beyond the free minutes, if the tariff meters minutes
+template <class Tariff>
+inline int TariffPlan<Tariff>::cycleCharge(int minutes) {
+    int charge = Tariff::monthlyCharge;
+    if ( Tariff::metered && minutes > Tariff::freeMinutes )
+        charge += ( minutes - Tariff::freeMinutes )*Tariff::chargePerMinute;
+    return charge;
+}
 
-//  test-harness operators
-enum Op { NONE, NewE, NewC, Balance, Call, Bill, Pay, PrintAll };
+// increments the minutes of row i by durations[i], for every row, as call() does for one row
+template <class Tariff>
+void TariffPlan<Tariff>::callAll(AccountColumns &columns, const int *durations) {
+    if ( !Tariff::metered )
+        return;
+    int n = columns.rows();
+    for (int i = 0; i < n; i++) {
+        if ( durations[i] != 0 )
+            columns.addMinutes( i, durations[i] );
+    }
+}
 
 
-//  converts a one-character input comment into its corresponding test-harness operator
-Op convertOp( string opStr ) {
-    switch( opStr[0] ) {
-        case 'E': return NewE;
-        case 'C': return NewC;
-        case 'b': return Balance;
-        case 'c': return Call;
-        case 'B': return Bill;
-        case 'p': return Pay;
-        case 'P': return PrintAll;
-        default: {
-            cerr << "Invalid operation " << opStr << endl;
-            return NONE;
-        }
-    }
+// operations handed to dispatch(), one per call site that depends on the plan
+struct CallOp {
+    AccountColumns &columns; int row; int duration;
+    template <class Tariff> void apply() { TariffPlan<Tariff>::call( columns, row, duration ); }
+};
+
+struct BillRangeOp {
+    AccountColumns &columns; int begin; int end;
+    template <class Tariff> void apply() { TariffPlan<Tariff>::billRange( columns, begin, end ); }
+};
+
+struct CloseCycleOp {
+    AccountColumns &columns;
+    template <class Tariff> void apply() { TariffPlan<Tariff>::closeCycle( columns ); }
+};
+
+struct CallAllOp {
+    AccountColumns &columns; const int *durations;
+    template <class Tariff> void apply() { TariffPlan<Tariff>::callAll( columns, durations ); }
+};
+
+struct CycleChargeOp {
+    int minutes; int charge;
+    template <class Tariff> void apply() { charge = TariffPlan<Tariff>::cycleCharge( minutes ); }
+};
+
+struct DescribeOp {
+    const char *name; bool metered;
+    template <class Tariff> void apply() { name = Tariff::name(); metered = Tariff::metered; }
+};
+
+
+// accessor - returns the name of the plan (e.g., "Cheap")
+const char* planName( Plan plan ) {
+    DescribeOp op = { "", false };
+    dispatch( plan, op );
+    return op.name;
 }
 
+// accessor - returns true if the plan records minutes of calls
+bool planMetered( Plan plan ) {
+    DescribeOp op = { "", false };
+    dispatch( plan, op );
+    return op.metered;
+}
 
-// Reads anumber from cin and finds the corresponding Phone Service account
-// REQUIRES: the next word to read from cin is an integer
-// RETURNS: a pointer to a found account.  Otherwise, returns NULL
-Account* findAccount( map<AccountNo,Account*>  &accounts) {
-    int num;
-    cin >> num;
-    AccountNo act( num );
-    map<AccountNo,Account*>::iterator iter;
-    iter = accounts.find( act );
-    if ( iter == accounts.end() ) {
-        cerr << "Invalid Account Number!" << endl;
-        return NULL;
-    }
-    return iter->second;
+
+// writes the statement of an account as Account::print() shows it: the type of account, the account
+// number and balance, and the minutes if the plan records them
+void printStatement( ostream &out, const AccountNo &accountNo, Plan plan, int balance, int minutes ) {
+    out << planName( plan ) << "Account:" << '\n';
+    out << "  Account Number = " << accountNo << '\n';
+    out << "  Balance = " << (balance < 0 ? "-" : "") << "$" << abs(balance) << '\n';
+    if ( planMetered( plan ) )
+        out << "  Minutes = " << minutes << '\n';
 }
 
 
 //*******************
-// main()
+// Account
 //*******************
 
-int main () {
-    cout << "Test harness for family of phone-service accounts:" << endl << endl;
-    map<AccountNo, Account*> accounts;
+class Account {
+public:                                         // PUBLIC interface of Account
+    Account( const AccountNo&, Plan, AccountColumns& ); // constructor
+    AccountNo accountNo () const;                   // accessor - returns account number
+    Plan plan () const;                             // accessor - returns plan of the account
+    int row () const;                               // accessor - row of the account in its plan's column store
+    int balance () const;                           // accessor - returns balance as an integer
+    void call ( int duration, long long time );     // records information about a call (e.g., duration of call in minutes)
+    void pay (int amount);                          // increments balance by amount paid
+    void print() const;                             // prints information about the account (e.g., account number, balance, minutes used this month)
+    void printCalls() const;                        // prints the time and duration of every call of the account
+    bool balanceAsOf( int cycle, int &balance ) const; // accessor - balance at the close of the billing cycle
+private:
+    AccountNo const accountNo_;
+    Plan const plan_;
+    AccountColumns* const columns_;
+    int const row_;
+};
 
-    cout << "Command: ";
-    string command;
-    cin >> command;
+// constructor -- constructs a new account on the plan with a balance of zero in a new row of the plan's column store
+Account::Account(const AccountNo &accountNo, Plan plan, AccountColumns &columns) : accountNo_(accountNo), plan_(plan), columns_(&columns), row_(columns.addRow()) { }
 
-    Op op = convertOp(command);
+// accessor - returns account number value of object
+AccountNo Account::accountNo() const {
+    return accountNo_;
+}
 
-    while ( !cin.eof() ) {
-        switch ( op ) {
-            /* Constructors */
-            case NewE: {
-                AccountNo act;
-                Account* p = new ExpensiveAccount( act );
-                accounts.insert( pair<AccountNo,Account*>( act, p ) );
-                p->print();
-                break;
-            }
-            case NewC: {
-                AccountNo act;
-                Account* p = new CheapAccount( act );
-                accounts.insert( pair<AccountNo,Account*>( act, p ) );
-                p->print();
-                break;
-            }
+// accessor - returns plan value of object
+Plan Account::plan() const {
+    return plan_;
+}
 
-                /* Accessors */
-            case Balance: {
-                Account* p = findAccount( accounts );
-                if ( p!= NULL)
-                    cout << "Value of balance data member is: " << p->balance() << endl;
-                break;
-            }
+// accessor - returns row value of object
+int Account::row() const {
+    return row_;
+}
 
-                /* Phone Service Operations */
-            case Call: {
-                Account* p = findAccount( accounts );
-                if ( p != NULL ) {
-                    int duration;
-                    cin >> duration;
-                    p->call( duration );
-                }
-                break;
-            }
+// accessor - returns balance value of object
+int Account::balance() const {
+    return columns_->balanceAt(row_);
+}
 
+// records the call under the rules of the account's tariff (a switch on the plan, not a virtual call),
+// and keeps its time (seconds since the epoch, when the call was made) and duration in the call history of the plan
+void Account::call(int duration, long long time) {
+    CallOp op = { *columns_, row_, duration };
+    dispatch( plan_, op );
+    columns_->history().append( row_, time, duration );
+}
 
-            case Bill: {
-                map<AccountNo,Account*>::iterator iter;
-                map<AccountNo,Account*>::iterator end = accounts.end();
-                for ( iter = accounts.begin(); iter != end; iter++ ) {
-                    (iter->second)->bill();
-                }
-                break;
-            }
+// increments balance value of object by the amount
+void Account::pay(int amount) {
+    columns_->balanceAtIs(row_, columns_->balanceAt(row_) + amount);
+}
 
+// prints type of account, the account number and balance values of the object, and the minutes
+// value of the object if its plan records minutes
+void Account::print() const {
+    printStatement( cout, accountNo_, plan_, balance(), columns_->minutesAt(row_) );
+}
 
-            case Pay: {
-                Account* p = findAccount( accounts );
-                if (p != NULL ) {
-                    int amt;
-                    cin >> amt;
-                    p->pay(amt);
-                }
-                break;
-            }
+// accessor - changes balance to the balance of the account at the close of billing cycle number cycle
+// (the cycle ended by the cycle-th bill), or to the current balance if that cycle is still open
+// RETURNS: false if the account was opened after the cycle closed
+bool Account::balanceAsOf(int cycle, int &balance) const {
+    return columns_->balanceAsOf(row_, cycle, balance);
+}
 
+// prints the number of calls of the account, then the time (seconds since the epoch) and duration of each
+void Account::printCalls() const {
+    cout << "  Account Number = " << accountNo_ << ", Calls = " << columns_->history().calls(row_) << endl;
+    CallHistory::Cursor cursor( columns_->history(), row_ );
+    long long time;
+    int duration;
+    while ( cursor.next( time, duration ) )
+        cout << "    Time = " << time << ", Minutes = " << duration << endl;
+}
 
-                /* Print Accounts */
-            case PrintAll: {
-                map<AccountNo,Account*>::iterator iter;
-                map<AccountNo,Account*>::iterator end = accounts.end();
-                for ( iter = accounts.begin(); iter != end; iter++ ) {
-                    (iter->second)->print();
-                }
-                break;
-            }
-            default: {
-                break;
-            }
-        } // switch
 
-        cout << endl << "Command: ";
-        cin >> command;
-        op = convertOp(command);
+//*******************
+// AccountArena
+//*******************
+
+class AccountArena {                            // Slab allocator for the accounts of one plan
+public:
+    AccountArena();                                 // constructor
+    ~AccountArena();                                // destructor -- releases every slab
+    void* allocate();                               // mutator - returns storage for one account
+    void release();                                 // mutator - frees the storage of every account at once
+private:
+    AccountArena( const AccountArena& );            // copying is prohibited
+    AccountArena& operator= ( const AccountArena& );
+    vector<Account*> slabs_;
+    Account* next_;                                 // next free account in the newest slab
+    Account* end_;                                  // one past the last account in the newest slab
+    static size_t const slabSize_ = 4096;           // accounts per slab
+};
+
+// release() frees accounts without running their destructors
+static_assert( is_trivially_destructible<Account>::value, "Account must be trivially destructible" );
+
 
-    } // while cin OK
+// constructor -- constructs an arena with no slabs
+AccountArena::AccountArena() : next_(NULL), end_(NULL) { }
 
-    map<AccountNo,Account*>::iterator iter;
-    map<AccountNo,Account*>::iterator end = accounts.end();
-    for ( iter = accounts.begin(); iter != end; iter++ )
-        delete iter->second;
+// destructor -- frees every slab
+AccountArena::~AccountArena() {
+    release();
+}
+
+// mutator - bumps the pointer into the newest slab, starting a new slab when it is full, so the
+// accounts of a plan are laid out next to each other in creation order
+void* AccountArena::allocate() {
+    if ( next_ == end_ ) {
+        next_ = static_cast<Account*>( ::operator new( slabSize_*sizeof(Account) ) );
+        end_ = next_ + slabSize_;
+        slabs_.push_back( next_ );
+    }
+    return next_++;
+}
+
+// mutator - frees every slab; every account allocated from the arena is gone afterwards
+void AccountArena::release() {
+    for ( vector<Account*>::size_type i = 0; i < slabs_.size(); i++ )
+        ::operator delete( slabs_[i] );
+    slabs_.clear();
+    next_ = end_ = NULL;
+}
+
+
+// writes all count bytes to the file descriptor, retrying short and interrupted writes
+// RETURNS: true if every byte was written
+bool writeFully( int fd, const char *bytes, size_t count ) {
+    while ( count > 0 ) {
+        ssize_t written = write( fd, bytes, count );
+        if ( written < 0 && errno == EINTR )
+            continue;
+        if ( written < 0 )
+            return false;
+        bytes += written;
+        count -= written;
+    }
+    return true;
+}
+
+// copies count values of type T from the bytes at cur into the vector and advances cur past them.  The
+// values are copied rather than read in place, since they need not be aligned where they are stored.
+template <class T>
+void readColumn( const char *&cur, size_t count, vector<T> &values ) {
+    values.resize( count );
+    if ( count > 0 )
+        memcpy( &values[0], cur, count*sizeof(T) );
+    cur += count*sizeof(T);
+}
+
+
+//*******************
+// ReportWriter
+//*******************
+
+struct ReportRecord {                               // Binary statement record, as stored after the "RPT1" file header
+    long long account;                              // account number
+    int balance;                                    // balance
+    int minutes;                                    // minutes used this month (zero for plans without metered minutes)
+    char plan;                                      // first letter of the plan name ('C' for Cheap Plan, 'E' for Expensive Plan)
+    char pad[7];
+};
+
+class ReportWriter {                                // Formats account statements into a large buffer written with few system calls
+public:
+    enum Format { Text, Csv, Binary };
+    ReportWriter( Format, int fd );                 // constructor
+    ~ReportWriter();                                // destructor -- writes any buffered statements
+    void add( const AccountNo&, Plan, int balance, int minutes ); // mutator - appends the statement of one account
+    bool flush();                                   // writes the buffer to the file descriptor; returns false on error
+private:
+    ReportWriter( const ReportWriter& );            // copying is prohibited
+    ReportWriter& operator= ( const ReportWriter& );
+    void append( const char*, size_t );             // appends bytes, writing the buffer out first if it is full
+    void append( const char* );                     // appends a null-terminated string
+    void appendNumber( long long, int width = 0 );  // appends a decimal number, zero-padded to the width
+    Format format_;
+    int fd_;
+    bool ok_;
+    string buffer_;
+    static size_t const capacity_ = 1 << 20;
+};
+
+
+// constructor -- constructs a writer of the format onto the file descriptor, with an empty buffer of capacity_ bytes
+ReportWriter::ReportWriter(Format format, int fd) : format_(format), fd_(fd), ok_(true) {
+    buffer_.reserve( capacity_ );
+    if ( format_ == Csv ) {
+        append( "account,plan,balance,minutes\n", 29 );
+    } else if ( format_ == Binary ) {
+        char header[sizeof(ReportRecord)] = "RPT1";
+        append( header, sizeof(header) );
+    }
+}
+
+// destructor -- writes any statements still in the buffer
+ReportWriter::~ReportWriter() {
+    flush();
+}
+
+// mutator - appends the statement of the account in the writer's format.  Text statements are
+// byte-for-byte what Account::print() writes.
+void ReportWriter::add(const AccountNo &accountNo, Plan plan, int balance, int minutes) {
+    switch ( format_ ) {
+        case Text: {
+            append( planName( plan ) );
+            append( "Account:\n  Account Number = ", 28 );
+            appendNumber( accountNo.number(), 4 );
+            append( "\n  Balance = ", 13 );
+            if ( balance < 0 )
+                append( "-", 1 );
+            append( "$", 1 );
+            appendNumber( abs( balance ) );
+            append( "\n", 1 );
+            if ( planMetered( plan ) ) {
+                append( "  Minutes = ", 12 );
+                appendNumber( minutes );
+                append( "\n", 1 );
+            }
+            break;
+        }
+        case Csv: {
+            appendNumber( accountNo.number(), 4 );
+            append( ",", 1 );
+            append( planName( plan ) );
+            append( ",", 1 );
+            appendNumber( balance );
+            append( ",", 1 );
+            if ( planMetered( plan ) )
+                appendNumber( minutes );
+            append( "\n", 1 );
+            break;
+        }
+        case Binary: {
+            ReportRecord record;
+            memset( &record, 0, sizeof(record) );
+            record.account = accountNo.number();
+            record.balance = balance;
+            record.minutes = minutes;
+            record.plan = planName( plan )[0];
+            append( reinterpret_cast<const char*>( &record ), sizeof(record) );
+            break;
+        }
+    }
+}
+
+// writes the whole buffer with as few write() calls as the kernel allows, then empties it
+bool ReportWriter::flush() {
+    if ( ok_ )
+        ok_ = writeFully( fd_, buffer_.data(), buffer_.size() );
+    buffer_.clear();
+    return ok_;
+}
+
+// appends the bytes to the buffer, writing the buffer out first if they do not fit
+void ReportWriter::append(const char *bytes, size_t count) {
+    if ( buffer_.size() + count > capacity_ )
+        flush();
+    buffer_.append( bytes, count );
+}
+
+// appends the characters of the null-terminated string
+void ReportWriter::append(const char *text) {
+    append( text, strlen( text ) );
+}
+
+// appends the decimal digits of the number, padded with leading zeros to the width
+void ReportWriter::appendNumber(long long number, int width) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *cur = end;
+    bool negative = number < 0;
+    unsigned long long value = negative ? -(unsigned long long)number : number;
+    do {
+        *--cur = char( '0' + value % 10 );
+        value /= 10;
+    } while ( value > 0 );
+    while ( end - cur < width )
+        *--cur = '0';
+    if ( negative )
+        *--cur = '-';
+    append( cur, end - cur );
+}
+
+
+//*******************
+// AccountTable
+//*******************
+
+class AccountTable {                                // Dense table of accounts indexed directly by account number
+public:
+    AccountTable();                                 // constructor
+    ~AccountTable();                                // destructor
+    Account* open( Plan );                          // mutator - opens a new account on the plan (table keeps ownership)
+    Account* find( const AccountNo& ) const;        // accessor - finds account with the account number
+    int rows( Plan ) const;                         // accessor - number of accounts on the plan
+    void merge( Plan, const int*, const int* );     // mutator - applies columns of call minutes and payments to the plan
+    void recordCall( Plan, int, long long, int );   // mutator - adds a call to the call history of a row of the plan
+    int active( Plan ) const;                       // accessor - number of accounts on the plan with calls this cycle
+    void billAll();                                 // bills every account, in time proportional to the active accounts
+    void billRange( Plan, int, int );               // bills the extra minutes of active accounts [begin, end) of the plan
+    void closeCycle();                              // charges every account its monthly fee, ending the billing cycle
+    void printAll() const;                          // prints every account in account number order
+    void report( ReportWriter& ) const;             // adds the statement of every account, in account number order
+    bool checkpoint( int fd, long long ) const;     // writes a binary image of the table to the file descriptor
+    bool restore( const char*, size_t, long long& ); // mutator - replaces the table with a binary image
+    void debtors( int, size_t, vector<Account*>& ) const; // accessor - accounts below a balance, lowest balance first
+    long long totalBalance( Plan ) const;           // accessor - sum of the balances of the accounts on the plan
+private:
+    struct CheckpointHeader {                       // start of a checkpoint image; the plan columns follow it
+        char magic[4];                              // "ACK1"
+        int version;
+        AccountNo::Allocator allocator;
+        long long rows[NumPlans];
+        int charged[NumPlans];                      // monthly charges not yet folded into the stored balances
+        long long logged;                           // sequence number of the last write-ahead log record included
+        int cycles[NumPlans];                       // billing cycles closed
+        long long cycleRecords[NumPlans];           // stored balances in the cycle history
+        long long callSegments[NumPlans];           // segments in the call history
+    };
+    static int const checkpointVersion_ = 6;
+    struct PlanImage {                              // columns of one plan, copied out of a checkpoint image
+        vector<long long> numbers;
+        vector<int> balances, minutes;
+        vector<int> cycleHistory;                   // as AccountColumns::cycleHistory() lays it out
+        vector<CallHistory::Chain> callChains;      // as CallHistory::chains() and segments() hold them
+        vector<CallHistory::Segment> callSegments;
+    };
+    static size_t planBytes( const CheckpointHeader&, int plan ); // bytes of the plan's part of a checkpoint
+    AccountTable( const AccountTable& );            // copying is prohibited
+    AccountTable& operator= ( const AccountTable& );
+    Account* create( Plan, const AccountNo& );      // creates an account on the plan and stores it in its slot
+    void clear();                                   // destructs every account
+    vector<Account*> slots_;                        // slots_[n] is the account with number n, or NULL
+    AccountColumns columns_[NumPlans];              // balances and minutes, grouped by plan
+    AccountArena arenas_[NumPlans];                 // storage of the accounts, grouped by plan
+    vector<Account*> byRow_[NumPlans];              // byRow_[plan][row] is the account in that row of the plan's columns
+};
+
+
+// constructor -- constructs a new empty account table
+AccountTable::AccountTable() : slots_(1, (Account*)NULL) { }
+
+// destructor -- releases all accounts in the table
+AccountTable::~AccountTable() {
+    clear();
+}
+
+// mutator - creates an account on the plan with a new account number
+Account* AccountTable::open(Plan plan) {
+    return create( plan, AccountNo() );
+}
+
+// creates an account on the plan with the account number and stores it in the slot of
+// its account number, growing the table if needed
+Account* AccountTable::create(Plan plan, const AccountNo &accountNo) {
+    Account *account = new ( arenas_[plan].allocate() ) Account( accountNo, plan, columns_[plan] );
+    byRow_[plan].push_back( account );
+
+    vector<Account*>::size_type n = accountNo.number();
+    if ( n >= slots_.size() )
+        slots_.resize( n + 1, (Account*)NULL );
+    slots_[n] = account;
+    return account;
+}
+
+// accessor - returns the account with the account number, or NULL if there is no such account
+Account* AccountTable::find(const AccountNo &accountNo) const {
+    vector<Account*>::size_type n = accountNo.number();
+    if ( n >= slots_.size() )
+        return NULL;
+    return slots_[n];
+}
+
+// releases every account in bulk and empties the slots and columns
+void AccountTable::clear() {
+    slots_.assign( 1, (Account*)NULL );
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        arenas_[plan].release();
+        columns_[plan].clear();
+        byRow_[plan].clear();
+    }
+}
+
+// accessor - returns number of accounts opened on the plan
+int AccountTable::rows(Plan plan) const {
+    return columns_[plan].rows();
+}
+
+// mutator - records minutes[i] of calls and payments[i] of payments against row i of the plan's columns,
+// as call() and pay() would for each account of the plan
+void AccountTable::merge(Plan plan, const int *minutes, const int *payments) {
+    CallAllOp op = { columns_[plan], minutes };
+    dispatch( plan, op );
+    columns_[plan].addBalances( payments );
+}
+
+// mutator - adds a call made at the time (seconds since the epoch) to the call history of the row of the
+// plan, without billing it; merge() bills the minutes
+void AccountTable::recordCall(Plan plan, int row, long long time, int duration) {
+    columns_[plan].history().append( row, time, duration );
+}
+
+// accessor - returns number of accounts of the plan that made calls this cycle
+int AccountTable::active(Plan plan) const {
+    return columns_[plan].activeRows();
+}
+
+// bills each account in the table.  Only accounts that made calls this cycle are visited; the
+// monthly fee of every other account is applied lazily by closeCycle().
+void AccountTable::billAll() {
+    for ( int plan = 0; plan < NumPlans; plan++ )
+        billRange( Plan(plan), 0, columns_[plan].activeRows() );
+    closeCycle();
+}
+
+// bills entries [begin, end) of the plan's active accounts for their extra minutes with the plan's kernel
+void AccountTable::billRange(Plan plan, int begin, int end) {
+    BillRangeOp op = { columns_[plan], begin, end };
+    dispatch( plan, op );
+}
+
+// deducts each plan's monthly fee from all of its accounts in constant time and starts a new cycle
+void AccountTable::closeCycle() {
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        CloseCycleOp op = { columns_[plan] };
+        dispatch( Plan(plan), op );
+    }
+}
+
+// prints each account in the table as one text report written straight to standard output
+void AccountTable::printAll() const {
+    cout.flush();
+    ReportWriter writer( ReportWriter::Text, STDOUT_FILENO );
+    report( writer );
+}
+
+// adds the statement of each account in the table to the report, reading the plan columns directly
+void AccountTable::report(ReportWriter &writer) const {
+    for ( vector<Account*>::size_type i = 0; i < slots_.size(); i++ ) {
+        if ( slots_[i] != NULL ) {
+            Plan plan = slots_[i]->plan();
+            int row = slots_[i]->row();
+            writer.add( slots_[i]->accountNo(), plan, columns_[plan].balanceAt( row ), columns_[plan].minutesAt( row ) );
+        }
+    }
+}
+
+
+// writes a checkpoint image: a CheckpointHeader holding the account number allocator, the row count,
+// pending charges and cycle counts of each plan and the sequence number of the last write-ahead log record
+// the table includes, then for each plan its account numbers, balances and minutes in row order, its
+// cycle history, as AccountColumns::cycleHistory() lays it out, and the chain of each row and the
+// segments of its call history.
+// The columns are written straight from memory, so the cost is one write per column.
+bool AccountTable::checkpoint(int fd, long long logged) const {
+    CheckpointHeader header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, "ACK1", 4 );
+    header.version = checkpointVersion_;
+    header.allocator = AccountNo::allocator();
+    header.logged = logged;
+
+    vector<long long> numbers[NumPlans];
+    vector<int> history[NumPlans];
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        header.rows[plan] = columns_[plan].rows();
+        header.charged[plan] = columns_[plan].charged();
+        header.cycles[plan] = columns_[plan].cycles();
+        header.cycleRecords[plan] = columns_[plan].cycleRecords();
+        header.callSegments[plan] = columns_[plan].history().segments().size();
+        columns_[plan].cycleHistory( history[plan] );
+        for ( vector<Account*>::size_type row = 0; row < byRow_[plan].size(); row++ )
+            numbers[plan].push_back( byRow_[plan][row]->accountNo().number() );
+    }
+
+    if ( !writeFully( fd, reinterpret_cast<const char*>( &header ), sizeof(header) ) )
+        return false;
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        const AccountColumns &columns = columns_[plan];
+        size_t rows = columns.rows();
+        if ( rows > 0 &&
+             ( !writeFully( fd, reinterpret_cast<const char*>( &numbers[plan][0] ), rows*sizeof(long long) ) ||
+               !writeFully( fd, reinterpret_cast<const char*>( columns.balances() ), rows*sizeof(int) ) ||
+               !writeFully( fd, reinterpret_cast<const char*>( columns.minutes() ), rows*sizeof(int) ) ) )
+            return false;
+        if ( !history[plan].empty() &&
+             !writeFully( fd, reinterpret_cast<const char*>( &history[plan][0] ), history[plan].size()*sizeof(int) ) )
+            return false;
+        const vector<CallHistory::Chain> &chains = columns.history().chains();
+        const vector<CallHistory::Segment> &segments = columns.history().segments();
+        if ( rows > 0 &&
+             !writeFully( fd, reinterpret_cast<const char*>( &chains[0] ), rows*sizeof(CallHistory::Chain) ) )
+            return false;
+        if ( !segments.empty() &&
+             !writeFully( fd, reinterpret_cast<const char*>( &segments[0] ), segments.size()*sizeof(CallHistory::Segment) ) )
+            return false;
+    }
+    return true;
+}
+
+// returns the bytes the columns, cycle history and call history of the plan take in a checkpoint with the header
+size_t AccountTable::planBytes(const CheckpointHeader &header, int plan) {
+    return header.rows[plan]*( sizeof(long long) + 3*sizeof(int) + sizeof(CallHistory::Chain) ) +
+           header.cycles[plan]*sizeof(int) + header.cycleRecords[plan]*3*sizeof(int) +
+           header.callSegments[plan]*sizeof(CallHistory::Segment);
+}
+
+// mutator - replaces every account with those of the checkpoint image, restores the account number
+// allocator, the cycle history and the call history, and changes logged to the sequence number of the
+// last write-ahead log record the image includes.  The plan columns are copied in bulk out of the image,
+// which need not be aligned; nothing is parsed per account, except that the account numbers and both
+// histories are checked before the table is touched.
+// RETURNS: false, leaving the table unchanged, if the image is not a complete version 6 checkpoint,
+// its account numbers are out of range, repeated, or not yet handed out by its allocator, or either
+// history is inconsistent
+bool AccountTable::restore(const char *image, size_t size, long long &logged) {
+    if ( size < sizeof(CheckpointHeader) )
+        return false;
+    CheckpointHeader header;
+    memcpy( &header, image, sizeof(header) );
+    if ( memcmp( header.magic, "ACK1", 4 ) != 0 || header.version != checkpointVersion_ || header.logged < 0 )
+        return false;
+    size_t expected = sizeof(header);
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        if ( header.rows[plan] < 0 || header.rows[plan] > (long long)(size / 16) || header.cycles[plan] < 0 ||
+             header.cycles[plan] > (long long)(size / 4) || header.cycleRecords[plan] < 0 ||
+             header.cycleRecords[plan] > (long long)(size / 12) || header.callSegments[plan] < 0 ||
+             header.callSegments[plan] > (long long)(size / sizeof(CallHistory::Segment)) )
+            return false;
+        expected += planBytes( header, plan );
+    }
+    if ( size != expected )
+        return false;
+
+    // the numbers must be ones the allocator handed out, and each only once, since the table is
+    // indexed by number; this also bounds the size of slots_ by the size of the image
+    PlanImage plans[NumPlans];
+    vector<long long> numbers;
+    const char *cur = image + sizeof(header);
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        PlanImage &columns = plans[plan];
+        size_t rows = header.rows[plan];
+        readColumn( cur, rows, columns.numbers );
+        readColumn( cur, rows, columns.balances );
+        readColumn( cur, rows, columns.minutes );
+        readColumn( cur, header.cycles[plan] + rows + 3*header.cycleRecords[plan], columns.cycleHistory );
+        readColumn( cur, rows, columns.callChains );
+        readColumn( cur, header.callSegments[plan], columns.callSegments );
+        numbers.insert( numbers.end(), columns.numbers.begin(), columns.numbers.end() );
+        if ( !AccountColumns::validCycleHistory( columns.cycleHistory.data(), (int)rows, header.cycles[plan], header.cycleRecords[plan] ) ||
+             !CallHistory::valid( columns.callChains, columns.callSegments ) )
+            return false;
+    }
+    if ( !AccountNo::valid( header.allocator, (long long)numbers.size() ) )
+        return false;
+    for ( vector<long long>::size_type i = 0; i < numbers.size(); i++ ) {
+        if ( !AccountNo::valid( numbers[i] ) || numbers[i] >= header.allocator.nextBlock )
+            return false;
+    }
+    sort( numbers.begin(), numbers.end() );
+    if ( adjacent_find( numbers.begin(), numbers.end() ) != numbers.end() )
+        return false;
+
+    clear();
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        PlanImage &columns = plans[plan];
+        for ( size_t row = 0; row < columns.numbers.size(); row++ )
+            create( Plan(plan), AccountNo( columns.numbers[row] ) );
+        if ( !columns.numbers.empty() )
+            columns_[plan].load( columns.balances.data(), columns.minutes.data() );
+        columns_[plan].chargedIs( header.charged[plan] );
+        columns_[plan].cycleHistoryIs( columns.cycleHistory.data(), header.cycles[plan], header.cycleRecords[plan] );
+        columns_[plan].history().segmentsIs( columns.callChains, columns.callSegments );
+    }
+    AccountNo::allocatorIs( header.allocator );
+    logged = header.logged;
+    return true;
+}
+
+
+// accessor - appends to the list, lowest balance first, up to limit accounts whose balance is below
+// the threshold.  Walks each plan's balance index from its lowest balance and merges the walks, so
+// once the indexes have caught up with the balances changed since the last query, the cost depends
+// on the accounts listed, not on the size of the table.
+void AccountTable::debtors(int threshold, size_t limit, vector<Account*> &list) const {
+    AccountColumns::BalanceIndex::const_iterator next[NumPlans];
+    for ( int plan = 0; plan < NumPlans; plan++ )
+        next[plan] = columns_[plan].byBalance().begin();
+
+    while ( list.size() < limit ) {
+        int lowest = -1;
+        int lowestBalance = threshold;
+        for ( int plan = 0; plan < NumPlans; plan++ ) {
+            if ( next[plan] == columns_[plan].byBalance().end() )
+                continue;
+            int balance = next[plan]->first - columns_[plan].charged();
+            if ( balance < lowestBalance ) {
+                lowest = plan;
+                lowestBalance = balance;
+            }
+        }
+        if ( lowest < 0 )
+            return;
+        list.push_back( byRow_[lowest][next[lowest]->second] );
+        ++next[lowest];
+    }
+}
+
+// accessor - returns the sum of the balances of the accounts on the plan
+long long AccountTable::totalBalance(Plan plan) const {
+    return columns_[plan].totalBalance();
+}
+
+
+//*******************
+// BillingPool
+//*******************
+
+class BillingPool {                                 // Bills the account table on a pool of threads that steal work from each other
+public:
+    explicit BillingPool( int threads );            // constructor -- starts the worker threads
+    ~BillingPool();                                 // destructor -- stops the worker threads
+    void bill( AccountTable& );                     // mutator - bills every account, as AccountTable::billAll() does
+private:
+    struct Task {                                   // a range of one plan's active accounts
+        Plan plan;
+        int begin, end;
+    };
+    struct Worker {
+        mutex lock;                                 // guards tasks; held only to push, pop or steal one task
+        deque<Task> tasks;                          // own tasks are taken from the front, stolen from the back
+        long long rows;                             // rows billed in the current run
+        int chunks, stolen;                         // tasks run in the current run, and how many were stolen
+    };
+    BillingPool( const BillingPool& );              // copying is prohibited
+    BillingPool& operator= ( const BillingPool& );
+    void work( int id );                            // body of worker thread id
+    bool take( int id, Task& );                     // takes a task of worker id, stealing one if it has none left
+    vector<Worker*> workers_;
+    vector<thread> threads_;
+    mutex mutex_;
+    condition_variable start_;                      // signalled when a run starts or the pool stops
+    condition_variable done_;                       // signalled when the last worker finishes a run
+    AccountTable *table_;                           // table being billed in the current run
+    long long run_;                                 // number of the current run
+    int busy_;                                      // workers still running the current run
+    bool stopping_;
+    static int const chunkRows_ = 16384;            // accounts per task
+};
+
+
+// constructor -- starts the worker threads, which wait for a run
+BillingPool::BillingPool(int threads) : table_(NULL), run_(0), busy_(0), stopping_(false) {
+    for ( int i = 0; i < threads; i++ )
+        workers_.push_back( new Worker );
+    for ( int i = 0; i < threads; i++ )
+        threads_.push_back( thread( &BillingPool::work, this, i ) );
+}
+
+// destructor -- wakes the workers so they exit, then joins them
+BillingPool::~BillingPool() {
+    {
+        lock_guard<mutex> lock( mutex_ );
+        stopping_ = true;
+    }
+    start_.notify_all();
+    for ( vector<thread>::size_type i = 0; i < threads_.size(); i++ )
+        threads_[i].join();
+    for ( vector<Worker*>::size_type i = 0; i < workers_.size(); i++ )
+        delete workers_[i];
+}
+
+// mutator - cuts every plan's active accounts into tasks of chunkRows_ accounts, gives each worker a
+// contiguous share, waits for the workers to finish, then closes the cycle.  Accounts are billed
+// independently by the same kernels as billAll(), so the balances and everything printed afterwards
+// are identical to a sequential run whatever the order the tasks ran in.  Reports per-thread
+// progress on standard error.
+void BillingPool::bill(AccountTable &table) {
+    vector<Task> tasks;
+    for ( int plan = 0; plan < NumPlans; plan++ ) {
+        int rows = table.active( Plan(plan) );
+        for ( int begin = 0; begin < rows; begin += chunkRows_ ) {
+            Task task = { Plan(plan), begin, begin + chunkRows_ < rows ? begin + chunkRows_ : rows };
+            tasks.push_back( task );
+        }
+    }
+    size_t workers = workers_.size();
+    for ( size_t i = 0; i < workers; i++ ) {
+        Worker &worker = *workers_[i];
+        lock_guard<mutex> lock( worker.lock );
+        for ( size_t t = tasks.size()*i/workers; t < tasks.size()*(i + 1)/workers; t++ )
+            worker.tasks.push_back( tasks[t] );
+        worker.rows = 0;
+        worker.chunks = worker.stolen = 0;
+    }
+
+    {
+        unique_lock<mutex> lock( mutex_ );
+        table_ = &table;
+        busy_ = (int)workers;
+        run_++;
+        start_.notify_all();
+        while ( busy_ > 0 )
+            done_.wait( lock );
+        table_ = NULL;
+    }
+    table.closeCycle();
+
+    for ( size_t i = 0; i < workers; i++ ) {
+        cerr << "Billing thread " << i << ": " << workers_[i]->rows << " accounts in " << workers_[i]->chunks
+             << " chunks (" << workers_[i]->stolen << " stolen)" << endl;
+    }
+}
+
+// waits for each run, bills tasks until none are left anywhere, then reports the run finished
+void BillingPool::work(int id) {
+    long long seen = 0;
+    while ( true ) {
+        AccountTable *table;
+        {
+            unique_lock<mutex> lock( mutex_ );
+            while ( run_ == seen && !stopping_ )
+                start_.wait( lock );
+            if ( stopping_ )
+                return;
+            seen = run_;
+            table = table_;
+        }
+
+        Task task;
+        while ( take( id, task ) ) {
+            table->billRange( task.plan, task.begin, task.end );
+            workers_[id]->rows += task.end - task.begin;
+            workers_[id]->chunks++;
+        }
+
+        lock_guard<mutex> lock( mutex_ );
+        if ( --busy_ == 0 )
+            done_.notify_one();
+    }
+}
+
+// takes the next task of worker id or, when its own tasks are gone, steals the last task of
+// the first other worker that still has one
+// RETURNS: false once every worker's tasks are gone
+bool BillingPool::take(int id, Task &task) {
+    {
+        Worker &own = *workers_[id];
+        lock_guard<mutex> lock( own.lock );
+        if ( !own.tasks.empty() ) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for ( size_t i = 1; i < workers_.size(); i++ ) {
+        Worker &victim = *workers_[( id + i ) % workers_.size()];
+        lock_guard<mutex> lock( victim.lock );
+        if ( !victim.tasks.empty() ) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            workers_[id]->stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//*******************
+// SharedAccountStore
+//*******************
+
+class SharedAccountStore {                          // Accounts in a shared-memory segment that harness processes on one host attach to
+public:
+    enum Outcome { Done, NoAccount, Held };         // Held: another live process kept the account's slot past waitMillis_
+    SharedAccountStore();                           // constructor
+    ~SharedAccountStore();                          // destructor -- detaches from the segment, which outlives the process
+    bool attach( const string &name, long long capacity ); // mutator - creates the named segment, or attaches to it if it exists
+    bool attached() const;                          // accessor - true once attached
+    long long open( Plan );                         // mutator - opens an account on the plan, returns its number (0 if full, -1 if held)
+    Outcome find( long long number, Plan&, int &balance, int &minutes ) const; // accessor - lock-free read of the account
+    Outcome call( long long number, int duration ); // mutator - records a call of the account
+    Outcome pay( long long number, int amount );    // mutator - increments the balance of the account
+    long long billAll();                            // mutator - bills every account under the rules of its tariff, returns the number skipped
+    long long end() const;                          // accessor - one past the highest account number handed out
+private:
+    struct Header {                                 // start of the segment; the slots follow it
+        char magic[4];                              // "ACS2"
+        atomic<int> ready;                          // set by the creator once the header is complete
+        long long capacity;                         // slots in the segment; slot n holds account number n
+        atomic<long long> nextNumber;
+        char pad[40];                               // starts the slots on a cache line of their own
+    };
+    struct Slot {                                   // one account, guarded by a seqlock
+        atomic<unsigned> sequence;                  // odd while a writer holds the slot
+        atomic<int> owner;                          // process id of the writer holding the slot, or 0
+        atomic<int> plan;                           // plan plus one, or zero if no account has the number
+        atomic<int> balance;
+        atomic<int> minutes;
+    };
+    static int const waitMillis_ = 1000;            // longest wait for a slot, or for the creator of the segment
+    SharedAccountStore( const SharedAccountStore& ); // copying is prohibited
+    SharedAccountStore& operator= ( const SharedAccountStore& );
+    Slot* slot( long long number ) const;           // slot of the account number, or NULL if out of range
+    static bool lock( Slot&, unsigned &sequence );  // waits for the slot and holds it, setting the sequence to unlock with
+    static void unlock( Slot&, unsigned );
+    static bool release( Slot&, unsigned sequence ); // frees a slot whose writer died holding it
+    static bool waitedOut( chrono::steady_clock::time_point since ); // true once waitMillis_ have passed since the time
+    Header *header_;
+    Slot *slots_;
+    size_t size_;                                   // bytes mapped
+};
+
+static_assert( ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "shared-memory atomics must be lock-free" );
+
+
+// definition of static data member bound to a reference by chrono::milliseconds
+int const SharedAccountStore::waitMillis_;
+
+
+// constructor -- constructs a store attached to no segment
+SharedAccountStore::SharedAccountStore() : header_(NULL), slots_(NULL), size_(0) { }
+
+// destructor -- unmaps the segment; the accounts stay in it for other processes
+SharedAccountStore::~SharedAccountStore() {
+    if ( header_ != NULL )
+        munmap( header_, size_ );
+}
+
+// mutator - maps the POSIX shared-memory segment /name.  The first process creates it with room for
+// capacity accounts and publishes the header with ready; later processes wait for the size and ready
+// and use the capacity of the segment.  Remove /dev/shm/<name> to start over.
+// RETURNS: false if the segment can be neither created nor attached, or if its creator has not
+// finished it within waitMillis_, as when the creator died part way through
+bool SharedAccountStore::attach(const string &name, long long capacity) {
+    string path = "/" + name;
+    bool created = true;
+    int fd = shm_open( path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if ( fd < 0 && errno == EEXIST ) {
+        created = false;
+        fd = shm_open( path.c_str(), O_RDWR, 0600 );
+    }
+    if ( fd < 0 )
+        return false;
+
+    struct stat status;
+    chrono::steady_clock::time_point since = chrono::steady_clock::now();
+    if ( created ) {
+        size_ = sizeof(Header) + capacity*sizeof(Slot);
+        if ( ftruncate( fd, size_ ) != 0 ) {
+            close( fd );
+            return false;
+        }
+    } else {
+        do {
+            if ( fstat( fd, &status ) != 0 || ( status.st_size == 0 && waitedOut( since ) ) ) {
+                close( fd );
+                return false;
+            }
+            if ( status.st_size == 0 )
+                this_thread::yield();
+        } while ( status.st_size == 0 );
+        size_ = status.st_size;
+    }
+    void *base = mmap( NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( base == MAP_FAILED )
+        return false;
+
+    header_ = static_cast<Header*>( base );
+    slots_ = reinterpret_cast<Slot*>( header_ + 1 );
+    if ( created ) {
+        memcpy( header_->magic, "ACS2", 4 );
+        header_->capacity = capacity;
+        header_->nextNumber.store( 1 );
+        header_->ready.store( 1, memory_order_release );
+    } else {
+        bool ready;
+        while ( !( ready = header_->ready.load( memory_order_acquire ) != 0 ) && !waitedOut( since ) )
+            this_thread::yield();
+        if ( !ready || memcmp( header_->magic, "ACS2", 4 ) != 0 || size_ != sizeof(Header) + header_->capacity*sizeof(Slot) ) {
+            munmap( header_, size_ );
+            header_ = NULL;
+            return false;
+        }
+    }
+    return true;
+}
+
+// accessor - returns true if the store is attached to a segment
+bool SharedAccountStore::attached() const {
+    return header_ != NULL;
+}
+
+// mutator - claims the next account number with one atomic add and fills in its slot
+long long SharedAccountStore::open(Plan plan) {
+    long long number = header_->nextNumber.fetch_add( 1 );
+    Slot *s = slot( number );
+    if ( s == NULL )
+        return 0;
+    unsigned sequence;
+    if ( !lock( *s, sequence ) )
+        return -1;
+    s->balance.store( 0, memory_order_relaxed );
+    s->minutes.store( 0, memory_order_relaxed );
+    s->plan.store( plan + 1, memory_order_relaxed );
+    unlock( *s, sequence );
+    return number;
+}
+
+// accessor - copies the plan, balance and minutes of the account without taking the slot: the read is
+// retried until the sequence is even and unchanged around it, so no writer was part way through.
+// A sequence left odd for waitMillis_ by a writer that died is moved on by release().
+// RETURNS: NoAccount if no account has the number, or Held if a live writer kept the slot for waitMillis_
+SharedAccountStore::Outcome SharedAccountStore::find(long long number, Plan &plan, int &balance, int &minutes) const {
+    Slot *s = slot( number );
+    if ( s == NULL )
+        return NoAccount;
+    int planPlusOne;
+    unsigned before, held = 0;
+    chrono::steady_clock::time_point since;
+    while ( true ) {
+        before = s->sequence.load( memory_order_acquire );
+        if ( ( before & 1 ) != 0 ) {
+            if ( before != held ) {
+                held = before;
+                since = chrono::steady_clock::now();
+            } else if ( waitedOut( since ) && !release( *s, before ) )
+                return Held;
+            this_thread::yield();
+            continue;
+        }
+        planPlusOne = s->plan.load( memory_order_relaxed );
+        balance = s->balance.load( memory_order_relaxed );
+        minutes = s->minutes.load( memory_order_relaxed );
+        atomic_thread_fence( memory_order_acquire );
+        if ( s->sequence.load( memory_order_relaxed ) == before )
+            break;
+    }
+    if ( planPlusOne == 0 )
+        return NoAccount;
+    plan = Plan( planPlusOne - 1 );
+    return Done;
+}
+
+// mutator - increments the minutes of the account by the duration, if its plan meters minutes
+SharedAccountStore::Outcome SharedAccountStore::call(long long number, int duration) {
+    Slot *s = slot( number );
+    if ( s == NULL )
+        return NoAccount;
+    unsigned sequence;
+    if ( !lock( *s, sequence ) )
+        return Held;
+    int plan = s->plan.load( memory_order_relaxed );
+    if ( plan != 0 && planMetered( Plan( plan - 1 ) ) )
+        s->minutes.store( s->minutes.load( memory_order_relaxed ) + duration, memory_order_relaxed );
+    unlock( *s, sequence );
+    return plan != 0 ? Done : NoAccount;
+}
+
+// mutator - increments the balance of the account by the amount
+SharedAccountStore::Outcome SharedAccountStore::pay(long long number, int amount) {
+    Slot *s = slot( number );
+    if ( s == NULL )
+        return NoAccount;
+    unsigned sequence;
+    if ( !lock( *s, sequence ) )
+        return Held;
+    int plan = s->plan.load( memory_order_relaxed );
+    if ( plan != 0 )
+        s->balance.store( s->balance.load( memory_order_relaxed ) + amount, memory_order_relaxed );
+    unlock( *s, sequence );
+    return plan != 0 ? Done : NoAccount;
+}
+
+// mutator - deducts the cycle charge of its tariff from each account and changes its minutes to zero.
+// Accounts are billed one slot at a time, so readers never wait, but they may see a bill part way
+// through the table.  A slot a live process keeps for waitMillis_ is skipped, not billed.
+long long SharedAccountStore::billAll() {
+    long long skipped = 0;
+    for ( long long number = 1; number < end(); number++ ) {
+        Slot &s = slots_[number];
+        unsigned sequence;
+        if ( !lock( s, sequence ) ) {
+            skipped++;
+            continue;
+        }
+        int plan = s.plan.load( memory_order_relaxed );
+        if ( plan != 0 ) {
+            CycleChargeOp op = { s.minutes.load( memory_order_relaxed ), 0 };
+            dispatch( Plan( plan - 1 ), op );
+            s.balance.store( s.balance.load( memory_order_relaxed ) - op.charge, memory_order_relaxed );
+            s.minutes.store( 0, memory_order_relaxed );
+        }
+        unlock( s, sequence );
+    }
+    return skipped;
+}
+
+// accessor - returns one past the highest account number opened, limited to the capacity
+long long SharedAccountStore::end() const {
+    long long next = header_->nextNumber.load();
+    return next < header_->capacity ? next : header_->capacity;
+}
+
+// returns the slot of the account number, or NULL if the number is outside the segment
+SharedAccountStore::Slot* SharedAccountStore::slot(long long number) const {
+    if ( number < 1 || number >= header_->capacity )
+        return NULL;
+    return &slots_[number];
+}
+
+// takes the slot by moving its sequence from even to odd and recording this process as its owner,
+// waiting while another writer holds it.  A sequence left odd for waitMillis_ by a writer that died
+// is moved on by release().
+// RETURNS: false if a live writer kept the slot for waitMillis_
+bool SharedAccountStore::lock(Slot &s, unsigned &sequence) {
+    unsigned held = 0;
+    chrono::steady_clock::time_point since;
+    while ( true ) {
+        unsigned current = s.sequence.load( memory_order_relaxed );
+        if ( ( current & 1 ) == 0 ) {
+            if ( s.sequence.compare_exchange_weak( current, current + 1, memory_order_acquire ) ) {
+                s.owner.store( getpid(), memory_order_relaxed );
+                atomic_thread_fence( memory_order_release );
+                sequence = current + 1;
+                return true;
+            }
+        } else if ( current != held ) {
+            held = current;
+            since = chrono::steady_clock::now();
+        } else if ( waitedOut( since ) && !release( s, current ) )
+            return false;
+        this_thread::yield();
+    }
+}
+
+// releases the slot by moving its sequence on to the next even value, publishing the writes made under it
+void SharedAccountStore::unlock(Slot &s, unsigned sequence) {
+    s.owner.store( 0, memory_order_relaxed );
+    s.sequence.store( sequence + 1, memory_order_release );
+}
+
+// moves the sequence of a slot held for waitMillis_ on to the next even value if its owner no longer
+// exists.  The slot keeps whatever the dead writer stored; each field is written whole.  An owner of
+// zero, or of this process, which holds no slot while it waits, can only be left by a writer that died
+// between taking the slot and recording itself, or between clearing itself and releasing it.
+// RETURNS: false if the owner is still running
+bool SharedAccountStore::release(Slot &s, unsigned sequence) {
+    int owner = s.owner.load( memory_order_relaxed );
+    if ( owner != 0 && owner != getpid() && ( kill( owner, 0 ) == 0 || errno != ESRCH ) )
+        return false;
+    s.sequence.compare_exchange_strong( sequence, sequence + 1, memory_order_release );
+    return true;
+}
+
+// returns true once waitMillis_ have passed since the time
+bool SharedAccountStore::waitedOut(chrono::steady_clock::time_point since) {
+    return chrono::steady_clock::now() - since >= chrono::milliseconds( waitMillis_ );
+}
+
+
+//*******************
+// WriteAheadLog
+//*******************
+
+struct CallRecord {                                 // Binary call detail record, as stored after the "CDR2" file magic
+    long long account;                              // account number
+    int value;                                      // minutes of a call, or amount of a payment
+    char kind;                                      // 'c' call, 'p' payment; logs also hold 'E'/'C' opens and 'B' bills
+    char pad[3];
+    long long time;                                 // seconds since the epoch when a call was made
+};
+
+class WriteAheadLog {                               // Append-only log of account mutations, made durable in groups
+public:
+    WriteAheadLog();                                // constructor
+    ~WriteAheadLog();                               // destructor -- makes every appended record durable
+    bool open( const string& );                     // mutator - appends to the log file, creating it if needed
+    bool isOpen () const;                           // accessor - true if records are being logged
+    long long appended () const;                    // accessor - sequence number of the last record appended
+    void appendedIs( long long );                   // mutator - numbers the records of a log created by open() after this one
+    long long append( char kind, long long account, int value, long long time = 0 ); // mutator - queues a record, returns its sequence number
+    static long long base( const CallRecord& );     // accessor - sequence number a log's first record follows, from its header record
+    void commit( long long );                       // waits until the record with the sequence number is durable
+    void sync();                                    // waits until every appended record is durable
+private:
+    WriteAheadLog( const WriteAheadLog& );          // copying is prohibited
+    WriteAheadLog& operator= ( const WriteAheadLog& );
+    void flusher();                                 // background thread -- writes and fsyncs one group at a time
+    int fd_;
+    mutable mutex mutex_;
+    condition_variable pending_;                    // signalled when records are appended or the log closes
+    condition_variable durable_;                    // signalled when a group has been fsynced
+    vector<CallRecord> group_;                      // records appended since the last group was taken
+    long long appended_;                            // sequence number of the last appended record
+    long long synced_;                              // sequence number of the last durable record
+    int committers_;                                // threads waiting in commit(); the flusher does not delay a group for them
+    bool closing_;
+    thread flusher_;
+    static size_t const groupSize_ = 4096;          // a group is written as soon as it has this many records...
+    static int const groupDelayMicros_ = 2000;      // ...or once its first record has waited this long, or someone commits
+};
+
+
+// definition of static data member bound to a reference by chrono::microseconds
+int const WriteAheadLog::groupDelayMicros_;
+
+
+// constructor -- constructs a closed log; append() is a no-op until open() succeeds
+WriteAheadLog::WriteAheadLog() : fd_(-1), appended_(0), synced_(0), committers_(0), closing_(false) { }
+
+// destructor -- stops the flusher after it has made the last group durable
+WriteAheadLog::~WriteAheadLog() {
+    if ( !isOpen() )
+        return;
+    {
+        lock_guard<mutex> lock( mutex_ );
+        closing_ = true;
+    }
+    pending_.notify_one();
+    flusher_.join();
+    close( fd_ );
+}
+
+// mutator - opens the log file for appending and starts the flusher thread.  A new log starts with a
+// "CDR2" header record, so a log can be replayed like any CDR file; the header also holds the sequence
+// number the log's first record follows, appended(), at byte 8.  An existing log continues its own
+// numbering, after any partial record left by a crash is cut off.
+bool WriteAheadLog::open(const string &file) {
+    if ( isOpen() )
+        return false;
+    int fd = ::open( file.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+    if ( fd < 0 )
+        return false;
+    struct stat info;
+    CallRecord header;
+    memset( &header, 0, sizeof(header) );
+    bool ok = ( fstat( fd, &info ) == 0 );
+    if ( ok && info.st_size == 0 ) {
+        memcpy( &header, "CDR2", 4 );
+        memcpy( reinterpret_cast<char*>( &header ) + 8, &appended_, sizeof(appended_) );
+        ok = writeFully( fd, reinterpret_cast<const char*>( &header ), sizeof(header) ) && fdatasync( fd ) == 0;
+    } else if ( ok ) {
+        off_t records = info.st_size/sizeof(CallRecord) - 1;
+        ok = ( info.st_size >= (off_t)sizeof(CallRecord) && pread( fd, &header, sizeof(header), 0 ) == (ssize_t)sizeof(header) &&
+               memcmp( &header, "CDR2", 4 ) == 0 );
+        if ( ok && info.st_size != ( records + 1 )*(off_t)sizeof(CallRecord) )
+            ok = ftruncate( fd, ( records + 1 )*sizeof(CallRecord) ) == 0 && fdatasync( fd ) == 0;
+        appended_ = synced_ = base( header ) + records;
+    }
+    if ( !ok ) {
+        close( fd );
+        return false;
+    }
+    fd_ = fd;
+    flusher_ = thread( &WriteAheadLog::flusher, this );
+    return true;
+}
+
+// accessor - returns true if the log file is open
+bool WriteAheadLog::isOpen() const {
+    return fd_ >= 0;
+}
+
+// accessor - returns the sequence number of the last record appended, or the one records follow if none has been
+long long WriteAheadLog::appended() const {
+    lock_guard<mutex> lock( mutex_ );
+    return appended_;
+}
+
+// mutator - changes the sequence number the next record follows, so a log created by open() continues
+// the numbering of the checkpoint it starts from.  Only before open().
+void WriteAheadLog::appendedIs(long long sequence) {
+    appended_ = synced_ = sequence;
+}
+
+// accessor - returns the sequence number stored at byte 8 of a log's header record
+long long WriteAheadLog::base(const CallRecord &header) {
+    long long sequence;
+    memcpy( &sequence, reinterpret_cast<const char*>( &header ) + 8, sizeof(sequence) );
+    return sequence;
+}
+
+// mutator - queues the record for the next group and returns its sequence number, without waiting
+// for it to reach the disk.  Safe to call from many threads.  Returns 0 if the log is not open.
+long long WriteAheadLog::append(char kind, long long account, int value, long long time) {
+    if ( !isOpen() )
+        return 0;
+    CallRecord record;
+    memset( &record, 0, sizeof(record) );
+    record.account = account;
+    record.value = value;
+    record.kind = kind;
+    record.time = time;
+
+    long long sequence;
+    bool wake;
+    {
+        lock_guard<mutex> lock( mutex_ );
+        group_.push_back( record );
+        sequence = ++appended_;
+        wake = ( group_.size() == 1 || group_.size() >= groupSize_ );
+    }
+    if ( wake )
+        pending_.notify_one();
+    return sequence;
+}
+
+// waits until the group holding the record with the sequence number has been fsynced.  The flusher
+// writes a group at once while anyone waits here, so the group holds whatever was appended during
+// the previous fsync, and waiting threads share the next one.
+void WriteAheadLog::commit(long long sequence) {
+    if ( !isOpen() )
+        return;
+    unique_lock<mutex> lock( mutex_ );
+    if ( synced_ >= sequence )
+        return;
+    committers_++;
+    pending_.notify_one();
+    while ( synced_ < sequence )
+        durable_.wait( lock );
+    committers_--;
+}
+
+// waits until every record appended so far is durable
+void WriteAheadLog::sync() {
+    long long sequence;
+    {
+        lock_guard<mutex> lock( mutex_ );
+        sequence = appended_;
+    }
+    commit( sequence );
+}
+
+// takes whole groups of appended records and makes each durable with one write and one fdatasync,
+// so the cost of a sync is shared by every record that arrived while the previous one ran
+void WriteAheadLog::flusher() {
+    vector<CallRecord> group;
+    unique_lock<mutex> lock( mutex_ );
+    while ( true ) {
+        while ( group_.empty() && !closing_ )
+            pending_.wait( lock );
+        if ( group_.empty() && closing_ )
+            return;
+        if ( !closing_ && committers_ == 0 && group_.size() < groupSize_ )
+            pending_.wait_for( lock, chrono::microseconds( groupDelayMicros_ ) );
+
+        group.swap( group_ );
+        long long sequence = appended_;
+        lock.unlock();
+
+        if ( !writeFully( fd_, reinterpret_cast<const char*>( &group[0] ), group.size()*sizeof(CallRecord) ) ||
+             fdatasync( fd_ ) < 0 ) {
+            cerr << "Error: Could not write to the write-ahead log." << endl;
+            exit(1);
+        }
+        group.clear();
+
+        lock.lock();
+        synced_ = sequence;
+        durable_.notify_all();
+    }
+}
+
+
+//*******************
+// CallIngestor
+//*******************
+
+class CallIngestor {                                // Applies call and payment events from many streams at once
+public:
+    CallIngestor( AccountTable&, WriteAheadLog& );  // constructor
+    void ingest( const vector<string>& );           // mutator - one producer thread per event file, merged when all finish
+    long long calls () const;                       // accessor - number of call events applied
+    long long payments () const;                    // accessor - number of payment events applied
+    long long rejected () const;                    // accessor - number of events for unknown accounts or commands
+private:
+    struct Call {                                   // a call event, kept for the call history
+        int row;
+        int duration;
+        long long time;
+    };
+    struct Shard {                                  // per-thread counters; only its own producer writes to it
+        vector<int> minutes[NumPlans];              // minutes[plan][row] called since the ingest started
+        vector<int> payments[NumPlans];             // payments[plan][row] paid since the ingest started
+        vector<Call> calls[NumPlans];               // calls[plan] in the order they were read
+        long long callCount, payCount, rejectCount;
+        bool opened;
+    };
+    CallIngestor( const CallIngestor& );            // copying is prohibited
+    CallIngestor& operator= ( const CallIngestor& );
+    void produce( const string&, Shard& ) const;    // applies the events of one file to one shard
+    AccountTable &accounts_;
+    WriteAheadLog &log_;
+    long long calls_, payments_, rejected_;
+};
+
+
+// constructor -- constructs an ingestor for the account table, logging to the write-ahead log, with no events applied
+CallIngestor::CallIngestor(AccountTable &accounts, WriteAheadLog &log) : accounts_(accounts), log_(log), calls_(0), payments_(0), rejected_(0) { }
+
+// mutator - starts one producer thread per file, each applying "c <account> <minutes> [<time>]" and
+// "p <account> <amount>" events, one to a line, to its own shard with no locking, then merges the shards
+// into the account table, and their calls into the call history, once every producer has finished.
+// A call without a time (seconds since the epoch) is taken to be made when it is read.  No accounts
+// may be opened meanwhile.
+void CallIngestor::ingest(const vector<string> &files) {
+    vector<Shard> shards( files.size() );
+    for ( vector<Shard>::size_type s = 0; s < shards.size(); s++ ) {
+        for ( int plan = 0; plan < NumPlans; plan++ ) {
+            shards[s].minutes[plan].assign( accounts_.rows( Plan(plan) ), 0 );
+            shards[s].payments[plan].assign( accounts_.rows( Plan(plan) ), 0 );
+        }
+        shards[s].callCount = shards[s].payCount = shards[s].rejectCount = 0;
+        shards[s].opened = false;
+    }
+
+    vector<thread> producers;
+    for ( vector<string>::size_type s = 0; s < files.size(); s++ )
+        producers.push_back( thread( &CallIngestor::produce, this, cref(files[s]), ref(shards[s]) ) );
+    for ( vector<thread>::size_type s = 0; s < producers.size(); s++ )
+        producers[s].join();
+
+    for ( vector<Shard>::size_type s = 0; s < shards.size(); s++ ) {
+        if ( !shards[s].opened ) {
+            cerr << "Error: Could not open file \"" << files[s] << "\"." << endl;
+            continue;
+        }
+        for ( int plan = 0; plan < NumPlans; plan++ ) {
+            if ( accounts_.rows( Plan(plan) ) > 0 )
+                accounts_.merge( Plan(plan), &shards[s].minutes[plan][0], &shards[s].payments[plan][0] );
+            const vector<Call> &calls = shards[s].calls[plan];
+            for ( vector<Call>::size_type i = 0; i < calls.size(); i++ )
+                accounts_.recordCall( Plan(plan), calls[i].row, calls[i].time, calls[i].duration );
+        }
+        calls_ += shards[s].callCount;
+        payments_ += shards[s].payCount;
+        rejected_ += shards[s].rejectCount;
+    }
+}
+
+// accessor - returns number of call events applied
+long long CallIngestor::calls() const {
+    return calls_;
+}
+
+// accessor - returns number of payment events applied
+long long CallIngestor::payments() const {
+    return payments_;
+}
+
+// accessor - returns number of rejected events
+long long CallIngestor::rejected() const {
+    return rejected_;
+}
+
+// reads the events of the file and adds them to the shard; the account table is only read.  An event
+// whose account, amount or time is out of range is rejected rather than truncated.
+void CallIngestor::produce(const string &file, Shard &shard) const {
+    ifstream source( file.c_str() );
+    if ( source.fail() )
+        return;
+    shard.opened = true;
+
+    string line;
+    while ( getline( source, line ) ) {
+        const char *cur = line.c_str();
+        while ( isspace( (unsigned char)*cur ) )
+            cur++;
+        if ( *cur == '\0' )
+            continue;
+        char command = *cur;
+        while ( *cur != '\0' && !isspace( (unsigned char)*cur ) )
+            cur++;
+        char *end;
+        errno = 0;
+        long long num = strtoll( cur, &end, 10 );
+        bool ok = ( end != cur );
+        cur = end;
+        long value = strtol( cur, &end, 10 );
+        ok = ok && ( end != cur ) && value >= numeric_limits<int>::min() && value <= numeric_limits<int>::max();
+        cur = end;
+        long long when = strtoll( cur, &end, 10 );
+        if ( end == cur )
+            when = time( NULL );
+        ok = ok && errno != ERANGE;
+
+        Account *p = ( ok && AccountNo::valid( num ) ) ? accounts_.find( AccountNo( num ) ) : NULL;
+        if ( p == NULL ) {
+            shard.rejectCount++;
+        } else if ( command == 'c' ) {
+            log_.append( 'c', num, (int)value, when );
+            shard.minutes[p->plan()][p->row()] += value;
+            Call call = { p->row(), (int)value, when };
+            shard.calls[p->plan()].push_back( call );
+            shard.callCount++;
+        } else if ( command == 'p' ) {
+            log_.append( 'p', num, (int)value );
+            shard.payments[p->plan()][p->row()] += value;
+            shard.payCount++;
+        } else {
+            shard.rejectCount++;
+        }
+    }
+}
+
+
+//*******************
+// CommandReplayer
+//*******************
+
+class CommandReplayer {                             // Rebuilds account state by replaying a memory-mapped command file
+public:
+    explicit CommandReplayer( AccountTable&, WriteAheadLog *log = NULL ); // constructor
+    bool replay( const string&, long long logged = -1 ); // mutator - replays a text command file or binary CDR file
+    long long commands () const;                    // accessor - number of commands applied
+    long long rejected () const;                    // accessor - number of commands that could not be applied
+    long long logged () const;                      // accessor - last write-ahead log record included in a checkpoint replayed
+private:
+    CommandReplayer( const CommandReplayer& );      // copying is prohibited
+    CommandReplayer& operator= ( const CommandReplayer& );
+    void replayText( const char*, const char* );    // applies text commands in [begin, end)
+    bool replayRecords( const CallRecord*, size_t );// applies binary call detail records
+    void apply( char, long long, int, long long );  // applies one call or payment event
+    static long long parseNumber( const char*&, const char* ); // reads an integer, advancing the cursor
+    static bool numberFollows( const char*&, const char* ); // true if an integer follows on the same line
+    AccountTable &accounts_;
+    WriteAheadLog *log_;                            // log of the mutations replayed, or NULL
+    long long commands_, rejected_;
+    long long logged_;
+};
+
+
+// constructor -- constructs a replayer for the account table with no commands applied.  With an open
+// log, every mutation replayed is appended to it as the command loop would, so it survives a restart.
+CommandReplayer::CommandReplayer(AccountTable &accounts, WriteAheadLog *log) : accounts_(accounts), log_(log), commands_(0), rejected_(0), logged_(0) { }
+
+// mutator - maps the file into memory and replays it in place.  A file starting with "ACK1" is a
+// checkpoint image that replaces the table, which cannot be logged, so it is refused while the log is open; one starting with "CDR2" is read as an array of
+// CallRecords; anything else is read as harness commands (E, C, c, p and B change state; b and P
+// only print, so they are skipped).  Returns false if the file cannot be read, is a bad checkpoint,
+// or is a CDR file too short to hold its header record or of the older "CDR1" layout.
+// When logged is not -1 the file is a write-ahead log and the accounts already include its records up
+// to sequence number logged: those are skipped, and false is returned, replaying nothing, if the log
+// does not reach that record or starts after it.  A log replay that opens an account with a number
+// other than the logged one stops there and returns false.
+bool CommandReplayer::replay(const string &file, long long logged) {
+    int fd = open( file.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        return false;
+    struct stat info;
+    if ( fstat( fd, &info ) < 0 ) {
+        close( fd );
+        return false;
+    }
+    size_t size = info.st_size;
+    if ( size == 0 ) {
+        close( fd );
+        return true;
+    }
+    void *data = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( data == MAP_FAILED )
+        return false;
+    madvise( data, size, MADV_SEQUENTIAL );
+
+    const char *begin = static_cast<const char*>( data );
+    bool ok = true;
+    if ( size >= 4 && memcmp( begin, "ACK1", 4 ) == 0 ) {
+        ok = ( log_ == NULL || !log_->isOpen() ) && accounts_.restore( begin, size, logged_ );
+        for ( int plan = 0; ok && plan < NumPlans; plan++ )
+            commands_ += accounts_.rows( Plan(plan) );
+    }
+    else if ( size >= 4 && memcmp( begin, "CDR1", 4 ) == 0 )
+        ok = false;                                 // records without call times, from before CDR2
+    else if ( size >= 4 && memcmp( begin, "CDR2", 4 ) == 0 ) {
+        ok = ( size >= sizeof(CallRecord) );
+        if ( ok ) {
+            const CallRecord *records = reinterpret_cast<const CallRecord*>( begin );
+            long long count = size / sizeof(CallRecord) - 1;
+            long long skip = 0;
+            if ( logged >= 0 ) {
+                skip = logged - WriteAheadLog::base( records[0] );
+                ok = ( skip >= 0 && skip <= count );
+            }
+            if ( ok )
+                ok = replayRecords( records + 1 + skip, count - skip );
+        }
+    }
+    else
+        replayText( begin, begin + size );
+
+    munmap( data, size );
+    return ok;
+}
+
+// accessor - returns number of commands applied
+long long CommandReplayer::commands() const {
+    return commands_;
+}
+
+// accessor - returns number of commands rejected
+long long CommandReplayer::rejected() const {
+    return rejected_;
+}
+
+// accessor - returns the sequence number of the last write-ahead log record included in the last checkpoint
+// replayed, or 0 if none was
+long long CommandReplayer::logged() const {
+    return logged_;
+}
+
+// scans the text one token at a time without copying it; the first character of each command
+// token selects the operation, as in convertOp().  A call may end with the time it was made, in
+// seconds since the epoch; a call without one is taken to be made when the replay started.  Any other
+// command is rejected once, together with the rest of its line.
+void CommandReplayer::replayText(const char *cur, const char *end) {
+    long long now = time( NULL );
+    while ( true ) {
+        while ( cur < end && isspace( (unsigned char)*cur ) )
+            cur++;
+        if ( cur == end )
+            return;
+        char op = *cur;
+        while ( cur < end && !isspace( (unsigned char)*cur ) )
+            cur++;
+
+        switch ( op ) {
+            case 'E':
+            case 'C': {
+                Account *p = accounts_.open( op == 'E' ? ExpensivePlan : CheapPlan );
+                if ( log_ != NULL )
+                    log_->append( op, p->accountNo().number(), 0 );
+                commands_++;
+                break;
+            }
+            case 'B': {
+                if ( log_ != NULL )
+                    log_->append( 'B', 0, 0 );
+                accounts_.billAll();
+                commands_++;
+                break;
+            }
+            case 'P': break;
+            case 'b': parseNumber( cur, end ); break;
+            case 'c':
+            case 'p': {
+                long long num = parseNumber( cur, end );
+                int value = (int)parseNumber( cur, end );
+                long long when = ( op == 'c' && numberFollows( cur, end ) ) ? parseNumber( cur, end ) : now;
+                apply( op, num, value, when );
+                break;
+            }
+            default: {
+                while ( cur < end && *cur != '\n' )
+                    cur++;
+                rejected_++;
+                break;
+            }
+        }
+    }
+}
+
+// applies each record in order.  Write-ahead logs also hold account opens ('E', 'C'), which must
+// reproduce the logged account number, and bills ('B').
+// RETURNS: false, after applying the records before it, at an open whose account number is not the
+// next one the allocator hands out
+bool CommandReplayer::replayRecords(const CallRecord *records, size_t count) {
+    for ( size_t i = 0; i < count; i++ ) {
+        switch ( records[i].kind ) {
+            case 'E':
+            case 'C': {
+                if ( AccountNo::next() != records[i].account )
+                    return false;
+                accounts_.open( records[i].kind == 'E' ? ExpensivePlan : CheapPlan );
+                if ( log_ != NULL )
+                    log_->append( records[i].kind, records[i].account, 0 );
+                commands_++;
+                break;
+            }
+            case 'B': {
+                if ( log_ != NULL )
+                    log_->append( 'B', 0, 0 );
+                accounts_.billAll();
+                commands_++;
+                break;
+            }
+            default: apply( records[i].kind, records[i].account, records[i].value, records[i].time ); break;
+        }
+    }
+    return true;
+}
+
+// applies a call ('c') made at the time, or a payment ('p'), to the account, or counts it as rejected
+void CommandReplayer::apply(char kind, long long num, int value, long long time) {
+    Account *p = AccountNo::valid( num ) ? accounts_.find( AccountNo( num ) ) : NULL;
+    if ( p == NULL || (kind != 'c' && kind != 'p') ) {
+        rejected_++;
+        return;
+    }
+    if ( log_ != NULL )
+        log_->append( kind, num, value, kind == 'c' ? time : 0 );
+    if ( kind == 'c' )
+        p->call( value, time );
+    else
+        p->pay( value );
+    commands_++;
+}
+
+// skips blanks other than line ends and returns true if a digit follows on the same line
+bool CommandReplayer::numberFollows(const char *&cur, const char *end) {
+    while ( cur < end && ( *cur == ' ' || *cur == '\t' || *cur == '\r' ) )
+        cur++;
+    return cur < end && *cur >= '0' && *cur <= '9';
+}
+
+// skips leading white space and reads an optionally signed decimal integer, leaving the cursor after it.
+// Numbers too large for a long long are read as the largest one, so no account number matches them.
+long long CommandReplayer::parseNumber(const char *&cur, const char *end) {
+    while ( cur < end && isspace( (unsigned char)*cur ) )
+        cur++;
+    bool negative = ( cur < end && *cur == '-' );
+    if ( negative )
+        cur++;
+    long long number = 0;
+    while ( cur < end && *cur >= '0' && *cur <= '9' ) {
+        int digit = *cur++ - '0';
+        if ( number > ( numeric_limits<long long>::max() - digit )/10 )
+            number = numeric_limits<long long>::max();
+        else
+            number = number*10 + digit;
+    }
+    return negative ? -number : number;
+}
+
+
+//************************************************************************
+//  Helper variables and functions for test harness
+//************************************************************************
+
+//  test-harness operators
+enum Op { NONE, NewE, NewC, Balance, Call, Bill, Pay, PrintAll, Report, Ingest, Save, Load, Below, Top, Totals, Stats, History, AsOf, NumOps };
+
+
+//  converts a one-character input comment into its corresponding test-harness operator, or NONE
+Op parseOp( const string &opStr ) {
+    switch( opStr[0] ) {
+        case 'E': return NewE;
+        case 'C': return NewC;
+        case 'b': return Balance;
+        case 'c': return Call;
+        case 'B': return Bill;
+        case 'p': return Pay;
+        case 'P': return PrintAll;
+        case 'R': return Report;
+        case 'I': return Ingest;
+        case 'S': return Save;
+        case 'L': return Load;
+        case 'D': return Below;
+        case 'T': return Top;
+        case 'Q': return Totals;
+        case 's': return Stats;
+        case 'H': return History;
+        case 'A': return AsOf;
+        default: return NONE;
+    }
+}
+
+//  converts the input command as parseOp() does, reporting commands that are not operators
+Op convertOp( string opStr ) {
+    Op op = parseOp( opStr );
+    if ( op == NONE )
+        cerr << "Invalid operation " << opStr << endl;
+    return op;
+}
+
+
+// number of allocations made through operator new since the harness started, for the stats command
+atomic<long long> allocations( 0 );
+
+// counts the allocation and allocates the storage as the default operator new does; both replacements are
+// kept out of line so the compiler does not pair the malloc() and free() inside them with new and delete
+__attribute__((noinline)) void* operator new( size_t size ) {
+    allocations.fetch_add( 1, memory_order_relaxed );
+    void *p = malloc( size > 0 ? size : 1 );
+    if ( p == NULL )
+        throw bad_alloc();
+    return p;
+}
+
+// releases storage from the operator new above
+__attribute__((noinline)) void operator delete( void *p ) noexcept {
+    free( p );
+}
+
+// The remaining forms are replaced as well, so that every allocation is counted and no storage from
+// one allocator is released to another: the library and code built for C++14 or later call the sized
+// deletes, and the array and nothrow forms otherwise fall back to the library's own definitions.
+void* operator new[]( size_t size ) {
+    return operator new( size );
+}
+
+void* operator new( size_t size, const nothrow_t& ) noexcept {
+    try {
+        return operator new( size );
+    } catch ( const bad_alloc& ) {
+        return NULL;
+    }
+}
+
+void* operator new[]( size_t size, const nothrow_t& ) noexcept {
+    return operator new( size, nothrow );
+}
+
+void operator delete[]( void *p ) noexcept {
+    operator delete( p );
+}
+
+void operator delete( void *p, size_t ) noexcept {
+    operator delete( p );
+}
+
+void operator delete[]( void *p, size_t ) noexcept {
+    operator delete( p );
+}
+
+void operator delete( void *p, const nothrow_t& ) noexcept {
+    operator delete( p );
+}
+
+void operator delete[]( void *p, const nothrow_t& ) noexcept {
+    operator delete( p );
+}
+
+
+//  names of the test-harness operators, for the stats command
+const char* const opNames[] = { "NONE", "NewE", "NewC", "Balance", "Call", "Bill", "Pay", "PrintAll", "Report",
+                                "Ingest", "Save", "Load", "Below", "Top", "Totals", "Stats", "History", "AsOf" };
+
+
+//*******************
+// LatencyHistogram
+//*******************
+
+class LatencyHistogram {                            // Log-linear histogram of latencies in nanoseconds (HDR style)
+public:
+    LatencyHistogram();                             // constructor
+    void record( long long nanos );                 // mutator - adds one latency
+    long long count () const;                       // accessor - number of latencies recorded
+    long long mean () const;                        // accessor - mean latency
+    long long max () const;                         // accessor - largest latency
+    long long percentile( double ) const;           // accessor - latency below which the percentage of latencies lie
+private:
+    static int bucket( long long );                 // bucket of a latency
+    static long long lowest( int );                 // lowest latency of a bucket
+    static int const subBits_ = 4;                  // each power of two is split into 2^subBits_ buckets,
+    static int const buckets_ = 64 << subBits_;     // so every latency is known to within 1/16 of its value
+    long long counts_[buckets_];
+    long long count_, total_, max_;
+};
+
+
+// constructor -- constructs an empty histogram
+LatencyHistogram::LatencyHistogram() : count_(0), total_(0), max_(0) {
+    memset( counts_, 0, sizeof(counts_) );
+}
+
+// mutator - counts the latency in its bucket; constant time, no allocation
+void LatencyHistogram::record(long long nanos) {
+    if ( nanos < 0 )
+        nanos = 0;
+    counts_[bucket( nanos )]++;
+    count_++;
+    total_ += nanos;
+    if ( nanos > max_ )
+        max_ = nanos;
+}
+
+// accessor - returns count value of object
+long long LatencyHistogram::count() const {
+    return count_;
+}
+
+// accessor - returns mean of the latencies, or zero if there are none
+long long LatencyHistogram::mean() const {
+    return count_ > 0 ? total_ / count_ : 0;
+}
+
+// accessor - returns max value of object
+long long LatencyHistogram::max() const {
+    return max_;
+}
+
+// accessor - returns the lowest latency of the bucket holding the given percentile of the latencies
+long long LatencyHistogram::percentile(double percent) const {
+    long long rank = (long long)( count_ * percent / 100.0 );
+    long long seen = 0;
+    for ( int i = 0; i < buckets_; i++ ) {
+        seen += counts_[i];
+        if ( seen > rank )
+            return lowest( i ) < max_ ? lowest( i ) : max_;
+    }
+    return max_;
+}
+
+// latencies below 2^subBits_ get a bucket each; above that, the bucket is the position of the
+// highest set bit and the next subBits_ bits below it
+int LatencyHistogram::bucket(long long nanos) {
+    if ( nanos < (1LL << subBits_) )
+        return (int)nanos;
+    int high = 63 - __builtin_clzll( (unsigned long long)nanos );
+    int sub = (int)( ( nanos >> ( high - subBits_ ) ) & ( (1 << subBits_) - 1 ) );
+    return ( ( high - subBits_ + 1 ) << subBits_ ) + sub;
+}
+
+// inverse of bucket() -- the lowest latency that falls in the bucket
+long long LatencyHistogram::lowest(int bucket) {
+    if ( bucket < (1 << subBits_) )
+        return bucket;
+    int high = ( bucket >> subBits_ ) + subBits_ - 1;
+    long long sub = bucket & ( (1 << subBits_) - 1 );
+    return ( 1LL << high ) | ( sub << ( high - subBits_ ) );
+}
+
+
+//*******************
+// HarnessStats
+//*******************
+
+class HarnessStats {                                // Latency and failure counters of the harness command loop
+public:
+    HarnessStats();                                 // constructor
+    void record( Op, long long nanos );             // mutator - adds the latency of one command
+    void lookupFailed();                            // mutator - counts a findAccount() miss
+    void print( ostream& ) const;                   // writes every counter as text
+    bool exportTo( const string& ) const;           // replaces the file with the text of print()
+    void exportEvery( const string&, int seconds ); // mutator - sets the file exportIfDue() replaces, and how often
+    void exportIfDue( chrono::steady_clock::time_point now ); // exports if the export interval has passed
+private:
+    LatencyHistogram latency_[NumOps];
+    long long failedLookups_;
+    string exportFile_;                             // file of the periodic export, or empty for none
+    int exportInterval_;                            // seconds between periodic exports
+    chrono::steady_clock::time_point lastExport_;
+};
+
+
+// constructor -- constructs counters with nothing recorded and no periodic export
+HarnessStats::HarnessStats() : failedLookups_(0), exportInterval_(0), lastExport_(chrono::steady_clock::now()) { }
+
+// mutator - adds the latency to the histogram of the operator
+void HarnessStats::record(Op op, long long nanos) {
+    latency_[op].record( nanos );
+}
+
+// mutator - increments the number of failed account lookups
+void HarnessStats::lookupFailed() {
+    failedLookups_++;
+}
+
+// writes the count, mean and percentiles of each operator that ran, the failed lookups and the allocations
+void HarnessStats::print(ostream &out) const {
+    for ( int op = NewE; op < NumOps; op++ ) {
+        const LatencyHistogram &h = latency_[op];
+        if ( h.count() == 0 )
+            continue;
+        out << "  " << opNames[op] << ": count = " << h.count() << ", mean = " << h.mean()
+            << "ns, p50 = " << h.percentile( 50 ) << "ns, p99 = " << h.percentile( 99 )
+            << "ns, p99.9 = " << h.percentile( 99.9 ) << "ns, max = " << h.max() << "ns" << endl;
+    }
+    out << "  Failed account lookups = " << failedLookups_ << endl;
+    out << "  Allocations = " << allocations.load( memory_order_relaxed ) << endl;
+}
+
+// writes the counters to a temporary file and renames it over the file, so readers never see a partial export
+bool HarnessStats::exportTo(const string &file) const {
+    string temporary = file + ".tmp";
+    {
+        ofstream out( temporary.c_str() );
+        if ( out.fail() )
+            return false;
+        print( out );
+        if ( out.fail() )
+            return false;
+    }
+    return rename( temporary.c_str(), file.c_str() ) == 0;
+}
+
+// mutator - changes the file and interval of the periodic export
+void HarnessStats::exportEvery(const string &file, int seconds) {
+    exportFile_ = file;
+    exportInterval_ = seconds;
+}
+
+// exports to the periodic export file if one is set and the interval has passed since the last export.
+// Called between commands, so the export needs no thread of its own.
+void HarnessStats::exportIfDue(chrono::steady_clock::time_point now) {
+    if ( exportFile_.empty() || now - lastExport_ < chrono::seconds( exportInterval_ ) )
+        return;
+    if ( !exportTo( exportFile_ ) )
+        cerr << "Error: Could not write file \"" << exportFile_ << "\"." << endl;
+    lastExport_ = now;
+}
+
+
+// Finds the Phone Service account with the number
+// RETURNS: a pointer to a found account.  Otherwise, reports the miss and returns NULL
+Account* findAccount( AccountTable &accounts, HarnessStats &stats, long long num ) {
+    AccountNo act( num );
+    Account* p = accounts.find( act );
+    if ( p == NULL ) {
+        stats.lookupFailed();
+        cerr << "Invalid Account Number!" << endl;
+        return NULL;
+    }
+    return p;
+}
+
+// Reads anumber from cin and finds the corresponding Phone Service account
+// REQUIRES: the next word to read from cin is an integer
+// RETURNS: a pointer to a found account.  Otherwise, returns NULL
+Account* findAccount( AccountTable &accounts, HarnessStats &stats ) {
+    long long num;
+    cin >> num;
+    return findAccount( accounts, stats, num );
+}
+
+// Runs one command of the test harness, reading its arguments from cin and printing its results to cout.
+// A command that changes accounts returns only once its log record is durable, so the prompt that
+// follows acknowledges a mutation that survives a crash.
+void execute( Op op, AccountTable &accounts, WriteAheadLog &log, BillingPool *pool, HarnessStats &stats ) {
+    switch ( op ) {
+        /* Constructors */
+        case NewE: {
+            Account* p = accounts.open( ExpensivePlan );
+            log.commit( log.append( 'E', p->accountNo().number(), 0 ) );
+            p->print();
+            break;
+        }
+        case NewC: {
+            Account* p = accounts.open( CheapPlan );
+            log.commit( log.append( 'C', p->accountNo().number(), 0 ) );
+            p->print();
+            break;
+        }
+
+            /* Accessors */
+        case Balance: {
+            Account* p = findAccount( accounts, stats );
+            log.sync();
+            if ( p!= NULL)
+                cout << "Value of balance data member is: " << p->balance() << endl;
+            break;
+        }
+
+            /* Phone Service Operations */
+        case Call: {
+            Account* p = findAccount( accounts, stats );
+            if ( p != NULL ) {
+                int duration;
+                cin >> duration;
+                long long now = time( NULL );
+                long long sequence = log.append( 'c', p->accountNo().number(), duration, now );
+                p->call( duration, now );
+                log.commit( sequence );
+            }
+            break;
+        }
+
+
+        case Bill: {
+            long long sequence = log.append( 'B', 0, 0 );
+            if ( pool != NULL )
+                pool->bill( accounts );
+            else
+                accounts.billAll();
+            log.commit( sequence );
+            break;
+        }
+
+
+        case Pay: {
+            Account* p = findAccount( accounts, stats );
+            if (p != NULL ) {
+                int amt;
+                cin >> amt;
+                long long sequence = log.append( 'p', p->accountNo().number(), amt );
+                p->pay(amt);
+                log.commit( sequence );
+            }
+            break;
+        }
+
+
+            /* Write statements of all accounts to a file as text, csv or binary */
+        case Report: {
+            string format, file;
+            cin >> format >> file;
+            log.sync();
+            int fd = open( file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+            if ( fd < 0 ) {
+                cerr << "Error: Could not open file \"" << file << "\"." << endl;
+                break;
+            }
+            {
+                ReportWriter writer( format[0] == 'c' ? ReportWriter::Csv : format[0] == 'b' ? ReportWriter::Binary : ReportWriter::Text, fd );
+                accounts.report( writer );
+            }
+            close( fd );
+            break;
+        }
+
+
+            /* Checkpoint the account table to a file.  The image is written to a temporary file, made
+               durable and renamed over the file, so a crash never leaves a partial checkpoint behind */
+        case Save: {
+            string file;
+            cin >> file;
+            string temporary = file + ".tmp";
+            int fd = open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+            log.sync();
+            bool ok = fd >= 0 && accounts.checkpoint( fd, log.appended() ) && fdatasync( fd ) == 0;
+            if ( fd >= 0 && close( fd ) != 0 )
+                ok = false;
+            if ( ok )
+                ok = rename( temporary.c_str(), file.c_str() ) == 0;
+            if ( !ok ) {
+                unlink( temporary.c_str() );
+                cerr << "Error: Could not write file \"" << file << "\"." << endl;
+            }
+            break;
+        }
+
+            /* Restore a checkpoint, or replay a command or CDR file; with -w, what the replay changes is logged */
+        case Load: {
+            string file;
+            cin >> file;
+            CommandReplayer replayer( accounts, &log );
+            if ( !replayer.replay( file ) )
+                cerr << "Error: Could not load file \"" << file << "\"." << endl;
+            log.sync();
+            break;
+        }
+
+
+            /* Concurrent ingestion of call and payment event files */
+        case Ingest: {
+            int n;
+            cin >> n;
+            vector<string> files( n > 0 ? n : 0 );
+            for ( vector<string>::size_type i = 0; i < files.size(); i++ )
+                cin >> files[i];
+            CallIngestor ingestor( accounts, log );
+            ingestor.ingest( files );
+            log.sync();
+            cout << "Ingested " << ingestor.calls() << " calls and " << ingestor.payments()
+                 << " payments (" << ingestor.rejected() << " rejected)" << endl;
+            break;
+        }
+
+
+            /* Collections queries, served from the balance indexes */
+        case Below:
+        case Top: {
+            int n;
+            cin >> n;
+            vector<Account*> list;
+            if ( op == Below )
+                accounts.debtors( n, (size_t)-1, list );
+            else
+                accounts.debtors( 0, n > 0 ? n : 0, list );
+            log.sync();
+            for ( vector<Account*>::size_type i = 0; i < list.size(); i++ ) {
+                int balance = list[i]->balance();
+                cout << "  Account Number = " << list[i]->accountNo() << ", Balance = "
+                     << (balance < 0 ? "-" : "") << "$" << abs(balance) << endl;
+            }
+            break;
+        }
+
+        case Totals: {
+            log.sync();
+            for ( int plan = 0; plan < NumPlans; plan++ ) {
+                long long total = accounts.totalBalance( Plan(plan) );
+                cout << planName( Plan(plan) ) << " Plan: " << accounts.rows( Plan(plan) ) << " accounts, total balance = "
+                     << (total < 0 ? "-" : "") << "$" << (total < 0 ? -total : total) << endl;
+            }
+            break;
+        }
+
+
+            /* Print Accounts */
+        case PrintAll: {
+            log.sync();
+            accounts.printAll();
+            break;
+        }
+            /* Call detail records of an account */
+        case History: {
+            Account* p = findAccount( accounts, stats );
+            log.sync();
+            if ( p != NULL )
+                p->printCalls();
+            break;
+        }
+
+            /* Balance of an account at the close of a billing cycle */
+        case AsOf: {
+            Account* p = findAccount( accounts, stats );
+            if ( p != NULL ) {
+                int cycle, balance;
+                cin >> cycle;
+                log.sync();
+                if ( p->balanceAsOf( cycle, balance ) )
+                    cout << "Balance at close of cycle " << cycle << " is: " << balance << endl;
+                else
+                    cout << "No account at close of cycle " << cycle << endl;
+            }
+            break;
+        }
+
+            /* Command statistics */
+        case Stats: {
+            stats.print( cout );
+            break;
+        }
+        default: {
+            break;
+        }
+    } // switch
+}
+
+
+// Reports an account of the shared store that another process kept locked for too long
+void reportHeld( long long num ) {
+    cerr << "Error: Account " << AccountNo( num ) << " is held by another process." << endl;
+}
+
+// Finds the account with the number in the shared store, reporting a miss as findAccount() does
+bool findShared( SharedAccountStore &store, HarnessStats &stats, long long num, Plan &plan, int &balance, int &minutes ) {
+    SharedAccountStore::Outcome outcome = store.find( num, plan, balance, minutes );
+    if ( outcome == SharedAccountStore::NoAccount ) {
+        stats.lookupFailed();
+        cerr << "Invalid Account Number!" << endl;
+    } else if ( outcome == SharedAccountStore::Held )
+        reportHeld( num );
+    return outcome == SharedAccountStore::Done;
+}
+
+// Runs one command of the test harness against a shared account store.  Only the commands that open,
+// look up, call, pay, bill and print accounts apply there; the rest of the line of any other command
+// is skipped.
+void executeShared( Op op, SharedAccountStore &store, HarnessStats &stats ) {
+    Plan plan;
+    int balance, minutes;
+    long long num;
+    switch ( op ) {
+        case NewE:
+        case NewC: {
+            long long number = store.open( op == NewE ? ExpensivePlan : CheapPlan );
+            if ( number == 0 )
+                cerr << "Error: The shared store is full." << endl;
+            else if ( number < 0 )
+                cerr << "Error: The new account is held by another process." << endl;
+            else if ( store.find( number, plan, balance, minutes ) == SharedAccountStore::Done )
+                printStatement( cout, AccountNo( number ), plan, balance, minutes );
+            else
+                reportHeld( number );
+            break;
+        }
+        case Balance: {
+            cin >> num;
+            if ( findShared( store, stats, num, plan, balance, minutes ) )
+                cout << "Value of balance data member is: " << balance << endl;
+            break;
+        }
+        case Call:
+        case Pay: {
+            cin >> num;
+            if ( !findShared( store, stats, num, plan, balance, minutes ) )
+                break;
+            int amount;
+            cin >> amount;
+            if ( ( op == Call ? store.call( num, amount ) : store.pay( num, amount ) ) == SharedAccountStore::Held )
+                reportHeld( num );
+            break;
+        }
+        case Bill: {
+            long long skipped = store.billAll();
+            if ( skipped > 0 )
+                cerr << "Error: " << skipped << " accounts held by other processes were not billed." << endl;
+            break;
+        }
+        case PrintAll: {
+            for ( long long number = 1; number < store.end(); number++ ) {
+                SharedAccountStore::Outcome outcome = store.find( number, plan, balance, minutes );
+                if ( outcome == SharedAccountStore::Done )
+                    printStatement( cout, AccountNo( number ), plan, balance, minutes );
+                else if ( outcome == SharedAccountStore::Held )
+                    reportHeld( number );
+            }
+            break;
+        }
+        case Stats: {
+            stats.print( cout );
+            break;
+        }
+        case NONE: {
+            break;
+        }
+        default: {
+            cerr << "Operation " << opNames[op] << " is not available on a shared store" << endl;
+            cin.ignore( numeric_limits<streamsize>::max(), '\n' );
+            break;
+        }
+    } // switch
+}
+
+
+//************************************************************************
+//  Benchmarks for the account table
+//************************************************************************
+
+// elapsed nanoseconds between two steady-clock readings
+long long nanosBetween( chrono::steady_clock::time_point start, chrono::steady_clock::time_point end ) {
+    return chrono::duration_cast<chrono::nanoseconds>( end - start ).count();
+}
+
+
+// writes one CSV result line: throughput over every sample and latency percentiles of the samples
+void reportSamples( ostream &out, long long accounts, const string &operation, vector<long long> &samples ) {
+    sort( samples.begin(), samples.end() );
+    long long total = 0;
+    for ( vector<long long>::size_type i = 0; i < samples.size(); i++ )
+        total += samples[i];
+    size_t n = samples.size();
+    out << accounts << "," << operation << "," << n << "," << total / 1e9 << ","
+        << ( total > 0 ? n * 1e9 / total : 0.0 ) << ","
+        << samples[n*50/100] << "," << samples[n*99/100] << "," << samples[n*999/1000] << ","
+        << samples[n - 1] << endl;
+}
+
+
+// builds a table of the given number of accounts, half on each plan, and times single lookups,
+// calls and payments on random accounts, and whole-table Bill and PrintAll runs
+void benchmarkPopulation( ostream &out, long long accounts, mt19937 &random ) {
+    AccountNo::Allocator fresh = { 1, 0, 0 };
+    AccountNo::allocatorIs( fresh );
+    AccountTable table;
+    for ( long long i = 0; i < accounts; i++ )
+        table.open( i % 2 == 0 ? CheapPlan : ExpensivePlan );
+
+    uniform_int_distribution<long long> anyAccount( 1, accounts );
+    uniform_int_distribution<int> anyDuration( 1, 120 );
+    int const operations = 200000;
+    vector<long long> samples( operations );
+
+    int found = 0;
+    for ( int i = 0; i < operations; i++ ) {
+        AccountNo accountNo( anyAccount( random ) );
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        found += ( table.find( accountNo ) != NULL );
+        samples[i] = nanosBetween( start, chrono::steady_clock::now() );
+    }
+    if ( found != operations )
+        cerr << "Benchmark lookups missed " << operations - found << " accounts" << endl;
+    reportSamples( out, accounts, "findAccount", samples );
+
+    for ( int i = 0; i < operations; i++ ) {
+        AccountNo accountNo( anyAccount( random ) );
+        int duration = anyDuration( random );
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        table.find( accountNo )->call( duration, time( NULL ) );
+        samples[i] = nanosBetween( start, chrono::steady_clock::now() );
+    }
+    reportSamples( out, accounts, "call", samples );
+
+    for ( int i = 0; i < operations; i++ ) {
+        AccountNo accountNo( anyAccount( random ) );
+        int amount = anyDuration( random );
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        table.find( accountNo )->pay( amount );
+        samples[i] = nanosBetween( start, chrono::steady_clock::now() );
+    }
+    reportSamples( out, accounts, "pay", samples );
+
+    // each Bill follows calls on a tenth of the accounts, the activity of a typical cycle
+    int const runs = 5;
+    samples.resize( runs );
+    for ( int run = 0; run < runs; run++ ) {
+        for ( long long i = 0; i < accounts / 10; i++ )
+            table.find( AccountNo( anyAccount( random ) ) )->call( anyDuration( random )*3, time( NULL ) );
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        table.billAll();
+        samples[run] = nanosBetween( start, chrono::steady_clock::now() );
+    }
+    reportSamples( out, accounts, "Bill", samples );
+
+    int devNull = open( "/dev/null", O_WRONLY );
+    for ( int run = 0; run < runs; run++ ) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        {
+            ReportWriter writer( ReportWriter::Text, devNull );
+            table.report( writer );
+        }
+        samples[run] = nanosBetween( start, chrono::steady_clock::now() );
+    }
+    close( devNull );
+    reportSamples( out, accounts, "PrintAll", samples );
+}
+
+
+// runs the benchmarks for populations of 10^3 up to 10^maxExponent accounts and writes the results
+// as CSV, one line per population and operation, so runs of different builds can be compared
+// RETURNS: false if the results file cannot be written
+bool runBenchmarks( const string &file, int maxExponent ) {
+    ofstream out( file.c_str() );
+    if ( out.fail() )
+        return false;
+    out << "accounts,operation,samples,seconds,ops_per_second,p50_ns,p99_ns,p999_ns,max_ns" << endl;
+    mt19937 random( 247 );
+    long long accounts = 1000;
+    for ( int exponent = 3; exponent <= maxExponent; exponent++, accounts *= 10 ) {
+        benchmarkPopulation( out, accounts, random );
+        cerr << "Benchmarked " << accounts << " accounts" << endl;
+    }
+    return !out.fail();
+}
+
+
+//*******************
+// Doorbell
+//*******************
+
+class Doorbell {                                    // Lets a thread wait for another to make a condition true, spinning briefly before it sleeps
+public:
+    Doorbell();                                     // constructor
+    template <class Ready> void await( Ready ready ); // mutator - returns once ready() returns true
+    void ring();                                    // mutator - wakes any thread asleep in await(); call after making its condition true
+private:
+    Doorbell( const Doorbell& );                    // copying is prohibited
+    Doorbell& operator= ( const Doorbell& );
+    mutex mutex_;
+    condition_variable rung_;
+    atomic<int> sleepers_;                          // threads asleep in await(), or about to be
+    static int const spins_ = 128;                  // yields before a waiting thread sleeps
+};
+
+
+// constructor -- constructs a doorbell nobody waits on
+Doorbell::Doorbell() : sleepers_(0) { }
+
+// mutator - polls ready(), yielding between polls, and sleeps until rung once a short spin has not
+// seen it turn true.  A sleeper is counted before ready() is checked again, and ring() reads the count
+// after the condition was made true, so one of the two always sees the other.
+template <class Ready>
+void Doorbell::await(Ready ready) {
+    for ( int spin = 0; spin < spins_; spin++ ) {
+        if ( ready() )
+            return;
+        this_thread::yield();
+    }
+    unique_lock<mutex> lock( mutex_ );
+    sleepers_.fetch_add( 1 );
+    atomic_thread_fence( memory_order_seq_cst );
+    while ( !ready() )
+        rung_.wait( lock );
+    sleepers_.fetch_sub( 1 );
+}
+
+// mutator - wakes the sleepers, if any; costs a fence and a load when nobody sleeps
+void Doorbell::ring() {
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( sleepers_.load( memory_order_relaxed ) == 0 )
+        return;
+    lock_guard<mutex> lock( mutex_ );
+    rung_.notify_all();
+}
+
+
+//*******************
+// SpscQueue
+//*******************
+
+template <class T>
+class SpscQueue {                                   // Bounded ring of values passed from one thread to one other, locking only to sleep
+public:
+    explicit SpscQueue( size_t capacity );          // constructor -- capacity is rounded up to a power of two
+    void push( const T& );                          // mutator - appends the value, waiting while the ring is full (producer only)
+    void pop( T& );                                 // mutator - removes the oldest value, waiting while the ring is empty (consumer only)
+    bool empty() const;                             // accessor - true if no value is waiting (consumer only)
+private:
+    SpscQueue( const SpscQueue& );                  // copying is prohibited
+    SpscQueue& operator= ( const SpscQueue& );
+    vector<T> ring_;
+    size_t mask_;                                   // ring_.size() - 1
+    atomic<size_t> head_;                           // count of values popped; written by the consumer only
+    char pad_[64];                                  // keeps head_ and tail_ on separate cache lines
+    atomic<size_t> tail_;                           // count of values pushed; written by the producer only
+    Doorbell bell_;                                 // rung after each push and pop, for a side waiting on a full or empty ring
+};
+
+
+// constructor -- constructs an empty ring of at least the capacity
+template <class T>
+SpscQueue<T>::SpscQueue(size_t capacity) : head_(0), tail_(0) {
+    size_t size = 1;
+    while ( size < capacity )
+        size *= 2;
+    ring_.resize( size );
+    mask_ = size - 1;
+}
+
+// mutator - stores the value in the next free slot, then publishes it by advancing tail_
+template <class T>
+void SpscQueue<T>::push(const T &value) {
+    size_t tail = tail_.load( memory_order_relaxed );
+    if ( tail - head_.load( memory_order_acquire ) == ring_.size() )
+        bell_.await( [this, tail] { return tail - head_.load( memory_order_acquire ) != ring_.size(); } );
+    ring_[tail & mask_] = value;
+    tail_.store( tail + 1, memory_order_release );
+    bell_.ring();
+}
+
+// mutator - copies out the oldest value, then frees its slot by advancing head_
+template <class T>
+void SpscQueue<T>::pop(T &value) {
+    size_t head = head_.load( memory_order_relaxed );
+    if ( head == tail_.load( memory_order_acquire ) )
+        bell_.await( [this, head] { return head != tail_.load( memory_order_acquire ); } );
+    value = ring_[head & mask_];
+    head_.store( head + 1, memory_order_release );
+    bell_.ring();
+}
+
+// accessor - returns true if every value pushed has been popped
+template <class T>
+bool SpscQueue<T>::empty() const {
+    return head_.load( memory_order_relaxed ) == tail_.load( memory_order_acquire );
+}
+
+
+//*******************
+// CommandPipeline
+//*******************
+
+class CommandPipeline {                             // Runs the command loop as parse, apply and print stages on threads of their own
+public:
+    CommandPipeline( AccountTable&, WriteAheadLog&, BillingPool*, HarnessStats& ); // constructor
+    void run();                                     // mutator - runs every command on cin, printing as the command loop does
+private:
+    struct Parsed {                                 // a command read by the parse stage
+        Op op;
+        long long account;                          // account of b, c and p
+        int value;                                  // minutes of c, amount of p
+        long long time;                             // when c was read, the time of the call
+        string word;                                // text of an invalid command, or the value of c and p as read
+        bool ended;                                 // input ended with word
+        bool last;                                  // true after the last command; op and word are the command last read
+    };
+    struct Outcome {                                // what the print stage shows for a command
+        Op op;
+        bool found;                                 // the account of b exists
+        long long account;
+        Plan plan;
+        int balance;                                // balance of the account when the command was applied
+        long long logged;                           // log record of a mutation, made durable before its prompt is printed
+        bool last;
+    };
+    CommandPipeline( const CommandPipeline& );      // copying is prohibited
+    CommandPipeline& operator= ( const CommandPipeline& );
+    void parse();                                   // body of the parse stage
+    void apply();                                   // body of the apply stage
+    void print();                                   // body of the print stage
+    bool applies( Op ) const;                       // true for commands parsed and printed by the stages
+    AccountTable &accounts_;
+    WriteAheadLog &log_;
+    BillingPool *pool_;
+    HarnessStats &stats_;
+    SpscQueue<Parsed> parsed_;                      // parse stage to apply stage
+    SpscQueue<Outcome> outcomes_;                   // apply stage to print stage
+    atomic<long long> resumed_;                     // commands run by the apply stage on its own (parse stage waits for these)
+    atomic<long long> printed_;                     // outcomes printed and flushed by the print stage
+    Doorbell progress_;                             // rung when resumed_ or printed_ advances
+    AccountNo::Allocator allocator_;                // account numbering, handed to the apply stage and back
+};
+
+
+// constructor -- constructs the stages over the account table, log, billing pool and statistics of the harness
+CommandPipeline::CommandPipeline(AccountTable &accounts, WriteAheadLog &log, BillingPool *pool, HarnessStats &stats) : accounts_(accounts), log_(log), pool_(pool), stats_(stats), parsed_(4096), outcomes_(4096), resumed_(0), printed_(0) { }
+
+// mutator - parses cin on this thread while the apply and print stages run on two more.  Commands that
+// open, look up, call, pay or bill flow through all three stages; any other command is run whole by the
+// apply stage once everything before it is printed, with the parse stage waiting until it has read its
+// arguments, so input, output and errors come out exactly as the sequential loop produces them.  Also,
+// cin is untied from cout while the stages run, since reading cin would otherwise flush cout under the print stage.
+void CommandPipeline::run() {
+    allocator_ = AccountNo::allocator();
+    ostream *tied = cin.tie( NULL );
+    thread applier( &CommandPipeline::apply, this );
+    thread printer( &CommandPipeline::print, this );
+    parse();
+    applier.join();
+    printer.join();
+    cin.tie( tied );
+    AccountNo::allocatorIs( allocator_ );
+}
+
+// returns true for the commands the stages handle themselves
+bool CommandPipeline::applies(Op op) const {
+    return op == NONE || op == NewE || op == NewC || op == Balance || op == Call || op == Pay || op == Bill;
+}
+
+// reads commands from cin until end of input.  The value of c and p is read as a word: if the account
+// turns out to be missing, the sequential loop would read that word as the next command, so it is kept
+// for the apply stage to report; if it is not a number it is the next command.  Like the sequential
+// loop, a failed read at the end of input leaves the previous command to be reported if it is invalid.
+void CommandPipeline::parse() {
+    long long waits = 0;
+    string command;
+    bool pending = false;                           // command holds a word already read as the next command
+    while ( true ) {
+        if ( !pending ) {
+            cin >> command;
+            if ( cin.eof() )
+                break;
+        }
+        pending = false;
+        Parsed parsed = { parseOp( command ), 0, 0, 0, string(), false, false };
+        if ( !applies( parsed.op ) ) {
+            parsed_.push( parsed );
+            waits++;
+            progress_.await( [this, waits] { return resumed_.load( memory_order_acquire ) >= waits; } );
+            continue;
+        }
+        if ( parsed.op == NONE )
+            parsed.word = command;
+        if ( parsed.op == Balance || parsed.op == Call || parsed.op == Pay )
+            cin >> parsed.account;
+        if ( parsed.op == Call || parsed.op == Pay ) {
+            string word;
+            cin >> word;
+            char *end;
+            long long value = strtoll( word.c_str(), &end, 10 );
+            if ( !word.empty() && *end == '\0' ) {
+                parsed.value = (int)value;
+                parsed.time = time( NULL );
+                parsed.word = word;
+                parsed.ended = cin.eof();
+            } else if ( !word.empty() ) {
+                command = word;
+                pending = !cin.eof();
+            }
+        }
+        parsed_.push( parsed );
+    }
+    Parsed last = { parseOp( command ), 0, 0, 0, command, true, true };
+    parsed_.push( last );
+}
+
+// applies commands in order and hands the print stage what each one shows.  Account numbers are
+// allocated per thread, so this stage takes over the numbering of the thread that called run().
+void CommandPipeline::apply() {
+    AccountNo::allocatorIs( allocator_ );
+    long long outcomes = 0;
+    Parsed parsed;
+    while ( true ) {
+        parsed_.pop( parsed );
+        if ( parsed.last ) {
+            if ( parsed.op == NONE )
+                cerr << "Invalid operation " << parsed.word << endl;
+            break;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Outcome outcome = { parsed.op, false, 0, CheapPlan, 0, 0, false };
+        bool skipped = false;                       // a c or p whose account is missing, so its value is read as a command
+        switch ( parsed.op ) {
+            case NONE: {
+                cerr << "Invalid operation " << parsed.word << endl;
+                break;
+            }
+            case NewE:
+            case NewC: {
+                Account* p = accounts_.open( parsed.op == NewE ? ExpensivePlan : CheapPlan );
+                outcome.logged = log_.append( parsed.op == NewE ? 'E' : 'C', p->accountNo().number(), 0 );
+                outcome.account = p->accountNo().number();
+                outcome.plan = p->plan();
+                outcome.balance = p->balance();
+                break;
+            }
+            case Balance: {
+                Account* p = findAccount( accounts_, stats_, parsed.account );
+                log_.sync();
+                if ( p != NULL ) {
+                    outcome.found = true;
+                    outcome.balance = p->balance();
+                }
+                break;
+            }
+            case Call:
+            case Pay: {
+                Account* p = findAccount( accounts_, stats_, parsed.account );
+                if ( p == NULL ) {
+                    skipped = !parsed.word.empty();
+                } else if ( parsed.op == Call ) {
+                    outcome.logged = log_.append( 'c', p->accountNo().number(), parsed.value, parsed.time );
+                    p->call( parsed.value, parsed.time );
+                } else {
+                    outcome.logged = log_.append( 'p', p->accountNo().number(), parsed.value );
+                    p->pay( parsed.value );
+                }
+                break;
+            }
+            case Bill: {
+                outcome.logged = log_.append( 'B', 0, 0 );
+                if ( pool_ != NULL )
+                    pool_->bill( accounts_ );
+                else
+                    accounts_.billAll();
+                break;
+            }
+            default: {
+                progress_.await( [this, outcomes] { return printed_.load( memory_order_acquire ) >= outcomes; } );
+                execute( parsed.op, accounts_, log_, pool_, stats_ );
+                resumed_.fetch_add( 1, memory_order_release );
+                progress_.ring();
+                break;
+            }
+        }
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        stats_.record( parsed.op, nanosBetween( start, end ) );
+        stats_.exportIfDue( end );
+        outcomes_.push( outcome );
+        outcomes++;
+
+        if ( skipped ) {
+            cerr << "Invalid operation " << parsed.word << endl;
+            if ( parsed.ended )
+                continue;
+            stats_.record( NONE, 0 );
+            Outcome none = { NONE, false, 0, CheapPlan, 0, 0, false };
+            outcomes_.push( none );
+            outcomes++;
+        }
+    }
+    allocator_ = AccountNo::allocator();
+    Outcome last = { NONE, false, 0, CheapPlan, 0, 0, true };
+    outcomes_.push( last );
+}
+
+// prints each outcome and the next prompt.  The prompt after a mutation waits until its log record is
+// durable; the apply stage keeps filling the log's next group meanwhile, so the fsyncs are still shared.
+// Output is flushed whenever the stage catches up with the apply stage, before the outcome is counted as printed.
+void CommandPipeline::print() {
+    long long printed = 0;
+    Outcome outcome;
+    while ( true ) {
+        outcomes_.pop( outcome );
+        if ( outcome.last )
+            break;
+        log_.commit( outcome.logged );
+        if ( outcome.op == NewE || outcome.op == NewC )
+            printStatement( cout, AccountNo( outcome.account ), outcome.plan, outcome.balance, 0 );
+        else if ( outcome.op == Balance && outcome.found )
+            cout << "Value of balance data member is: " << outcome.balance << '\n';
+        cout << '\n' << "Command: ";
+        if ( outcomes_.empty() )
+            cout.flush();
+        printed_.store( ++printed, memory_order_release );
+        progress_.ring();
+    }
+    cout.flush();
+}
+
+
+//*******************
+// main()
+//*******************
+
+int main ( int argc, char *argv[] ) {
+    AccountTable accounts;
+    WriteAheadLog log;
+
+    // "-w <log>" replays the write-ahead log records not in any checkpoint loaded, then appends to it;
+    // "-j <threads>" bills on a pool of that many threads;
+    // "-b <results>" runs the benchmarks instead, up to 10^6 accounts or 10^<n> with "-n <n>";
+    // "-s <file>" exports the command statistics to the file every 10 seconds, or every <n> with "-t <n>";
+    // "-p" runs the command loop as a pipeline of parse, apply and print threads;
+    // "-m <name>" runs the commands against the shared-memory store <name>, creating it if needed
+    string logFile, benchFile, statsFile, storeName;
+    int billingThreads = 1;
+    int benchExponent = 6;
+    int statsInterval = 10;
+    bool pipelined = false;
+    while ( ( argc > 1 && string( argv[1] ) == "-p" ) || ( argc > 2 && argv[1][0] == '-' ) ) {
+        if ( string( argv[1] ) == "-p" ) {
+            pipelined = true;
+            argc -= 1;
+            argv += 1;
+            continue;
+        }
+        if ( string( argv[1] ) == "-w" )
+            logFile = argv[2];
+        else if ( string( argv[1] ) == "-j" )
+            billingThreads = atoi( argv[2] );
+        else if ( string( argv[1] ) == "-b" )
+            benchFile = argv[2];
+        else if ( string( argv[1] ) == "-n" )
+            benchExponent = atoi( argv[2] );
+        else if ( string( argv[1] ) == "-s" )
+            statsFile = argv[2];
+        else if ( string( argv[1] ) == "-t" )
+            statsInterval = atoi( argv[2] );
+        else if ( string( argv[1] ) == "-m" )
+            storeName = argv[2];
+        else
+            break;
+        argc -= 2;
+        argv += 2;
+    }
+    if ( !benchFile.empty() ) {
+        if ( !runBenchmarks( benchFile, benchExponent ) ) {
+            cerr << "Error: Could not write file \"" << benchFile << "\"." << endl;
+            return 1;
+        }
+        return 0;
+    }
+    // commands on a shared store bypass the account table, so nothing can be loaded into it, logged,
+    // pipelined or billed on a pool
+    if ( !storeName.empty() && ( pipelined || !logFile.empty() || billingThreads > 1 || argc > 1 ) ) {
+        cerr << "Error: -m cannot be combined with -p, -w, -j or a file to replay." << endl;
+        return 1;
+    }
+    BillingPool *pool = ( billingThreads > 1 ) ? new BillingPool( billingThreads ) : NULL;
+
+    // a shared store created by this process has room for 2^20 accounts
+    SharedAccountStore store;
+    if ( !storeName.empty() && !store.attach( storeName, 1 << 20 ) ) {
+        cerr << "Error: Could not attach shared store \"" << storeName << "\"." << endl;
+        return 1;
+    }
+
+    // rebuild account state by replaying a checkpoint, command or CDR file, if present.  Log records
+    // continue from the last one a checkpoint includes.
+    if ( argc > 1 ) {
+        CommandReplayer replayer( accounts );
+        if ( !replayer.replay( argv[1] ) ) {
+            cerr << "Error: Could not load file \"" << argv[1] << "\"." << endl;
+            return 1;
+        }
+        cout << "Replayed " << replayer.commands() << " commands (" << replayer.rejected() << " rejected)" << endl;
+        log.appendedIs( replayer.logged() );
+    }
+    if ( !logFile.empty() ) {
+        CommandReplayer replayer( accounts );
+        if ( access( logFile.c_str(), F_OK ) == 0 ) {
+            if ( !replayer.replay( logFile, log.appended() ) ) {
+                cerr << "Error: Write-ahead log \"" << logFile << "\" does not continue the loaded accounts." << endl;
+                return 1;
+            }
+            cout << "Replayed " << replayer.commands() << " logged mutations (" << replayer.rejected() << " rejected)" << endl;
+        }
+        if ( !log.open( logFile ) ) {
+            cerr << "Error: Could not open file \"" << logFile << "\"." << endl;
+            return 1;
+        }
+    }
+
+    cout << "Test harness for family of phone-service accounts:" << endl << endl;
+
+    HarnessStats stats;
+    stats.exportEvery( statsFile, statsInterval );
+
+    cout << "Command: ";
+    if ( pipelined ) {
+        CommandPipeline pipeline( accounts, log, pool, stats );
+        pipeline.run();
+    } else {
+        string command;
+        cin >> command;
+
+        Op op = convertOp(command);
+
+        while ( !cin.eof() ) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if ( store.attached() )
+                executeShared( op, store, stats );
+            else
+                execute( op, accounts, log, pool, stats );
+
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            stats.record( op, nanosBetween( start, end ) );
+            stats.exportIfDue( end );
+
+            cout << endl << "Command: ";
+            cin >> command;
+            op = convertOp(command);
+
+        } // while cin OK
+    }
 
+    if ( !statsFile.empty() )
+        stats.exportTo( statsFile );
+    delete pool;
     return 0;
 }
\ No newline at end of file
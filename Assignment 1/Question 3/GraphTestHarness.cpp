@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <list>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 using namespace std;
@@ -13,19 +21,58 @@ class BCode {
 public:
     BCode( string );                // constructor
     string code () const;           // accessor - string value of building code
+    unsigned long long packed () const; // accessor - building code packed into an integer
+    static constexpr unsigned long long encode( const char*, int width = 8 ); // packs up to width characters
+    static constexpr char decode( unsigned long long, int );                  // character at a position of a packed code
 private:
-    string code_;
+    unsigned long long code_;       // characters of the code, first in the high byte, zero padded
 };
 
 
 // constructor -- constructs a new building code
-BCode::BCode(string code) : code_(code) { }
+// REQUIRES: code has at most 8 characters
+BCode::BCode(string code) : code_(encode(code.c_str())) { }
 
-// accessor - returns code value of object
+// accessor - returns code value of object, unpacked into a string
 string BCode::code() const {
+    string code;
+    for(int i = 0; i < 8 && decode(code_, i) != '\0'; i++) {
+        code += decode(code_, i);
+    }
+    return code;
+}
+
+// accessor - returns packed code value of object
+unsigned long long BCode::packed() const {
     return code_;
 }
 
+// packs the characters of the code into the bytes of an integer, first character highest, so that
+// comparing packed codes compares the codes in string order
+constexpr unsigned long long BCode::encode(const char *code, int width) {
+    return (width == 0 || *code == '\0') ? 0 :
+            ((unsigned long long)(unsigned char)*code << (8*(width - 1))) | encode(code + 1, width - 1);
+}
+
+// returns the character at position i of a packed code, or '\0' past its end
+constexpr char BCode::decode(unsigned long long packed, int i) {
+    return (char)((packed >> (8*(7 - i))) & 0xff);
+}
+
+
+// comparison operators
+bool operator== (const BCode &a, const BCode &b) {
+    return a.packed() == b.packed();
+}
+
+bool operator!= (const BCode &a, const BCode &b) {
+    return !(a == b);
+}
+
+bool operator< (const BCode &a, const BCode &b) {
+    return a.packed() < b.packed();
+}
+
 
 //===================================================================
 // Building
@@ -64,7 +111,7 @@ string Building::name() const {
 
 // comparison operators
 bool operator< (const Building &a, const Building &b) {
-    return a.code() < b.code();
+    return a.bCode() < b.bCode();
 }
 
 bool operator>= (const Building &a, const Building &b) {
@@ -84,20 +131,32 @@ ostream& operator<< (ostream &sout, const Building &b) {
 // BuildingNode
 //===================================================================
 
+class BuildingEdge;
+
 class BuildingNode {
 public:
     BuildingNode( Building*, BuildingNode *next = NULL );   // constructor
     Building* building () const;                            // accessor - building value of the building node
     BuildingNode* next () const;                            // accessor - returns next building node
     void nextIs( BuildingNode* );                           // mutator - update the next building node
+    BuildingNode* prev () const;                            // accessor - returns previous building node
+    void prevIs( BuildingNode* );                           // mutator - update the previous building node
+    const vector<BuildingEdge*>& edges () const;            // accessor - building edges at the building node, oldest first
+    void addEdge( BuildingEdge* );                          // mutator - adds a building edge at the building node
+    void removeEdge( BuildingEdge* );                       // mutator - removes a building edge from the building node
+    int id () const;                                        // accessor - number of the building node in its graph, kept while it is there
+    void idIs( int );                                       // mutator - updates the number of the building node
 private:
     Building* building_;
     BuildingNode* next_;
+    BuildingNode* prev_;
+    vector<BuildingEdge*> edges_;
+    int id_;
 };
 
 
 // constructor -- constructs a new building node with an optional building and next building node
-BuildingNode::BuildingNode(Building *building, BuildingNode *next) : building_(building), next_(next) { }
+BuildingNode::BuildingNode(Building *building, BuildingNode *next) : building_(building), next_(next), prev_(NULL), id_(-1) { }
 
 // accessor - returns building value of object
 Building* BuildingNode::building() const {
@@ -114,6 +173,46 @@ void BuildingNode::nextIs(BuildingNode *next) {
     next_ = next;
 }
 
+// accessor - returns previous building node value of object
+BuildingNode* BuildingNode::prev() const {
+    return prev_;
+}
+
+// mutator - updates the previous building node value of object
+void BuildingNode::prevIs(BuildingNode *prev) {
+    prev_ = prev;
+}
+
+// accessor - returns building edges value of object
+const vector<BuildingEdge*>& BuildingNode::edges() const {
+    return edges_;
+}
+
+// mutator - appends the building edge to the building edges value of object
+void BuildingNode::addEdge(BuildingEdge *edge) {
+    edges_.push_back(edge);
+}
+
+// mutator - removes the building edge from the building edges value of object, keeping the others in order
+void BuildingNode::removeEdge(BuildingEdge *edge) {
+    for(vector<BuildingEdge*>::size_type i = 0; i < edges_.size(); i++) {
+        if(edges_[i] == edge) {
+            edges_.erase(edges_.begin() + i);
+            return;
+        }
+    }
+}
+
+// accessor - returns id value of object
+int BuildingNode::id() const {
+    return id_;
+}
+
+// mutator - updates the id value of object
+void BuildingNode::idIs(int id) {
+    id_ = id;
+}
+
 
 //===================================================================
 // Collection
@@ -128,6 +227,7 @@ public:
     Building* findBuilding( string ) const;     // accessor - find building in collection
 private:
     BuildingNode* buildings_;
+    unordered_map<unsigned long long, vector<BuildingNode*> > index_; // building nodes with each packed building code, the first in buildings_ last
 };
 
 
@@ -149,49 +249,91 @@ void Collection::insert(string code, string name) {
     BCode bCode = BCode(code);
     Building *building = new Building(bCode, name);
     buildings_ = new BuildingNode(building, buildings_);
+    if(buildings_->next()) {
+        buildings_->next()->prevIs(buildings_);
+    }
+    index_[bCode.packed()].push_back(buildings_);
 }
 
-// mutator - removes a building node with the building code from the buildings value of object
+// mutator - removes the first building node with the building code from the buildings value of object,
+// found through the index and unlinked through its previous building node, so the cost does not
+// depend on the building nodes before it.  New building nodes go first, so the first building node
+// with a building code is the newest one, and the next one with the code is the one inserted before it.
 void Collection::remove(string code) {
-    BuildingNode *curNode = buildings_;
-    // If the collection of buildings is empty then do nothing
-    if(curNode == NULL) {
+    unordered_map<unsigned long long, vector<BuildingNode*> >::iterator found = index_.find(BCode(code).packed());
+    // If no building has the building code then do nothing
+    if(found == index_.end()) {
         return;
     }
-    // If the root building node has the building code then delete the root node
-    else if (curNode->building()->code() == code) {
-        buildings_ = curNode->next();
-        delete curNode->building();
-        delete curNode;
-    }
-    // Otherwise check other building nodes and delete the building node with the building code
-    else {
-        while(curNode->next()) {
-            if(curNode->next()->building()->code() == code) {
-                BuildingNode *tempNode = curNode->next();
-                curNode->nextIs(tempNode->next());
-                delete tempNode->building();
-                delete tempNode;
-                return;
-            }
-            curNode = curNode->next();
-        }
+    BuildingNode *tempNode = found->second.back();
+    found->second.pop_back();
+    if(found->second.empty()) {
+        index_.erase(found);
     }
+    if(tempNode->prev()) {
+        tempNode->prev()->nextIs(tempNode->next());
+    } else {
+        buildings_ = tempNode->next();
+    }
+    if(tempNode->next()) {
+        tempNode->next()->prevIs(tempNode->prev());
+    }
+    delete tempNode->building();
+    delete tempNode;
 }
 
 // accessor - finds building with code in the collection
 Building* Collection::findBuilding(string code) const {
-    BuildingNode *curNode = buildings_;
-    while(curNode) {
-        if(curNode->building()->code() == code) {
-            return curNode->building();
-        }
-        curNode = curNode->next();
+    unordered_map<unsigned long long, vector<BuildingNode*> >::const_iterator found = index_.find(BCode(code).packed());
+    if(found != index_.end()) {
+        return found->second.back()->building();
     }
     return NULL;
 }
 
 
+//===================================================================
+// ConnectorType
+//===================================================================
+
+// Interns connector names: each distinct connector gets a small integer type id on first use, so
+// routing compares and indexes connector types by id instead of by string.
+class ConnectorType {
+public:
+    static int id( const string& );                         // type id of the connector, assigned on first use
+    static string name( int );                              // accessor - connector name of the type id
+    static int count();                                     // accessor - number of connector types so far
+private:
+    static unordered_map<string, int> ids_;
+    static vector<string> names_;
+};
+
+unordered_map<string, int> ConnectorType::ids_;
+vector<string> ConnectorType::names_;
+
+
+// returns the type id of the connector, giving it the next id if it has not been seen before
+int ConnectorType::id(const string &connector) {
+    unordered_map<string, int>::const_iterator found = ids_.find(connector);
+    if(found != ids_.end()) {
+        return found->second;
+    }
+    ids_[connector] = (int)names_.size();
+    names_.push_back(connector);
+    return (int)names_.size() - 1;
+}
+
+// accessor - returns connector name of the type id
+string ConnectorType::name(int type) {
+    return names_[type];
+}
+
+// accessor - returns number of connector types seen so far
+int ConnectorType::count() {
+    return (int)names_.size();
+}
+
+
 //===================================================================
 // BuildingEdge
 //===================================================================
@@ -202,19 +344,27 @@ public:
     BuildingNode* node1 () const;                                                   // accessor - first building node of the building edge
     BuildingNode* node2 () const;                                                   // accessor - second building node of the building edge
     string connector () const;                                                      // accessor - connector type of the building edge
+    int type () const;                                                              // accessor - type id of the connector of the building edge
     BuildingEdge* next () const;                                                    // accessor - next building edge of the building edge
     void nextIs( BuildingEdge* );                                                   // mutator - updates the next building edge
-    bool connects( string, string ) const;                                          // checks if the building edge connects two buildings
-    BuildingNode* connectsTo( string ) const;                                       // accessor - building node connected to in the building edge
+    BuildingEdge* prev () const;                                                    // accessor - previous building edge of the building edge
+    void prevIs( BuildingEdge* );                                                   // mutator - updates the previous building edge
+    long long order () const;                                                       // accessor - number of building edges added to the graph before it
+    void orderIs( long long );                                                      // mutator - updates the order of the building edge
+    bool connects( const BCode&, const BCode& ) const;                              // checks if the building edge connects two buildings
+    BuildingNode* connectsTo( const BCode& ) const;                                 // accessor - building node connected to in the building edge
 private:
     BuildingNode *node1_, *node2_;
     string connector_;
+    int type_;                                                                      // ConnectorType id of connector_
     BuildingEdge* next_;
+    BuildingEdge* prev_;
+    long long order_;
 };
 
 
 // constructor -- constructs a new building edge with two building nodes, connector type, and an optional next building edge
-BuildingEdge::BuildingEdge(BuildingNode *node1, BuildingNode *node2, string connector, BuildingEdge *next) : node1_(node1), node2_(node2), connector_(connector), next_(next) { }
+BuildingEdge::BuildingEdge(BuildingNode *node1, BuildingNode *node2, string connector, BuildingEdge *next) : node1_(node1), node2_(node2), connector_(connector), type_(ConnectorType::id(connector)), next_(next), prev_(NULL), order_(0) { }
 
 // accessor - returns first building node value of object
 BuildingNode* BuildingEdge::node1() const {
@@ -231,6 +381,11 @@ string BuildingEdge::connector() const {
     return connector_;
 }
 
+// accessor - returns connector type id value of object
+int BuildingEdge::type() const {
+    return type_;
+}
+
 // accessor - returns next building edge value of object
 BuildingEdge* BuildingEdge::next() const {
     return next_;
@@ -241,23 +396,96 @@ void BuildingEdge::nextIs(BuildingEdge *next) {
     next_ = next;
 }
 
+// accessor - returns previous building edge value of object
+BuildingEdge* BuildingEdge::prev() const {
+    return prev_;
+}
+
+// mutator - updates the previous building edge value of object
+void BuildingEdge::prevIs(BuildingEdge *prev) {
+    prev_ = prev;
+}
+
+// accessor - returns order value of object
+long long BuildingEdge::order() const {
+    return order_;
+}
+
+// mutator - updates the order value of object
+void BuildingEdge::orderIs(long long order) {
+    order_ = order;
+}
+
 // returns true if building edge connects two building nodes with the building code
-bool BuildingEdge::connects(string code1, string code2) const {
-    return (node1_->building()->code() == code1 && node2_->building()->code() == code2) ||
-            (node2_->building()->code() == code1 && node1_->building()->code() == code2);
+bool BuildingEdge::connects(const BCode &code1, const BCode &code2) const {
+    return (node1_->building()->bCode() == code1 && node2_->building()->bCode() == code2) ||
+            (node2_->building()->bCode() == code1 && node1_->building()->bCode() == code2);
 }
 
 // accessor - returns the other building node value of object
-BuildingNode* BuildingEdge::connectsTo(string code) const {
-    if(node1_->building()->code() == code) {
+BuildingNode* BuildingEdge::connectsTo(const BCode &code) const {
+    if(node1_->building()->bCode() == code) {
         return node2_;
-    } else if(node2_->building()->code() == code) {
+    } else if(node2_->building()->bCode() == code) {
         return node1_;
     }
     return NULL;
 }
 
 
+//===================================================================
+// RouteCosts
+//===================================================================
+
+// Cost of crossing a building edge of each connector type, for least-cost routing.  Connector types
+// without a cost of their own cost the default; a negative cost excludes the connector type from routes.
+class RouteCosts {
+public:
+    RouteCosts( int defaultCost = 1 );                      // constructor
+    void costIs( string, int );                             // mutator - updates the cost of a connector type
+    void exclude( string );                                 // mutator - excludes a connector type from routes
+    void defaultCostIs( int );                              // mutator - updates the cost of connector types without one
+    int cost( int ) const;                                  // accessor - cost of the type id, negative if excluded
+private:
+    int defaultCost_;
+    vector<int> costs_;                                     // cost of each type id; entries past the end cost the default
+    vector<char> set_;                                      // whether each type id has a cost of its own
+};
+
+
+// constructor -- constructs route costs where every connector type costs defaultCost
+RouteCosts::RouteCosts(int defaultCost) : defaultCost_(defaultCost) { }
+
+// mutator - updates the cost of the connector type
+void RouteCosts::costIs(string connector, int cost) {
+    int type = ConnectorType::id(connector);
+    if(type >= (int)costs_.size()) {
+        costs_.resize(type + 1, 0);
+        set_.resize(type + 1, false);
+    }
+    costs_[type] = cost;
+    set_[type] = true;
+}
+
+// mutator - excludes the connector type from routes
+void RouteCosts::exclude(string connector) {
+    costIs(connector, -1);
+}
+
+// mutator - updates the cost of connector types without a cost of their own
+void RouteCosts::defaultCostIs(int cost) {
+    defaultCost_ = cost;
+}
+
+// accessor - returns cost of crossing a building edge of the type id, negative if the type is excluded
+int RouteCosts::cost(int type) const {
+    if(type < (int)set_.size() && set_[type]) {
+        return costs_[type];
+    }
+    return defaultCost_;
+}
+
+
 //===================================================================
 // Graph (of Buildings and Connectors)
 //===================================================================
@@ -273,6 +501,7 @@ public:
     void addEdge ( string, string, string );                // mutator - add edge to graph
     void removeEdge ( string, string );                     // mutator - remove edge from graph
     void printPaths ( string, string, const bool = false ) const; // accessor - print path from one node to another
+    void printRoute ( string, string, const RouteCosts& ) const;  // accessor - print least-cost route from one node to another
     void deleteGraph();                                     // delete graph
     friend ostream& operator<< ( ostream&, const Graph& );  // insertion operator (insert graph into output stream)
     Graph& operator= ( const Graph& );                      // assignment operator for graph objects
@@ -282,22 +511,125 @@ public:
     void printNodes() const;
     void printEdges() const;
 private:
+    void copyGraph( const Graph& );                         // mutator - copies building nodes and edges of another graph into this empty one
     BuildingNode* findBuildingNode ( string ) const;        // accessor - finds building node in graph
-    void removeAdjacentEdges( string );                     // mutator - removes adjacent building edges of a building node in the graph
+    void removeAdjacentEdges( BuildingNode* );              // mutator - removes adjacent building edges of a building node in the graph
+    void unlinkEdge( BuildingEdge* );                       // mutator - removes a building edge from the graph and its building nodes
+    void compact() const;                                   // packs the building edges at each building node into CSR arrays
+    bool shortestPath( int, int, vector<int>&, vector<BuildingEdge*>& ) const; // finds a path with the fewest building edges
+    bool meetInMiddle( int, int, vector<int>&, vector<BuildingEdge*>& ) const; // finds one by a search from both ends
+    struct RouteTree;
+    const RouteTree& routeTree( int ) const;                // accessor - cached tree of shortest paths from a building node
+    void repairRoutes( BuildingEdge* );                     // mutator - updates the cached route trees for a new building edge
+    void cutRoutes( BuildingEdge* );                        // mutator - updates the cached route trees for a removed building edge
+    bool printAllPaths( int, int ) const;                   // prints every path that visits no building node twice
+    bool cheapestRoute( int, int, const RouteCosts&, vector<int>&, vector<BuildingEdge*>&, long long& ) const; // finds a least-cost route
+    void printPath( const vector<int>&, const vector<BuildingEdge*>& ) const;  // prints building codes joined by connectors
+    void newSearch() const;                                 // sizes the search buffers and starts a new stamp
 
     BuildingNode* nodes_;
-    BuildingEdge* edges_;
+    BuildingEdge* edges_;                                   // every building edge, newest first (the order they are printed in)
+    unordered_map<unsigned long long, BuildingNode*> index_; // first building node in nodes_ with each packed building code
+    vector<int> freeIds_;                                   // ids of removed building nodes, reused before new ones
+    vector<BuildingNode*> nodesById_;                       // building node with each id, or NULL if the id is free
+    int nextId_;                                            // one more than the largest id given to a building node
+    long long edgesAdded_;                                  // building edges ever added, which orders them by age
+
+    // CSR (compressed sparse row) copy of the building edges at each building node, rebuilt by compact()
+    // on the first search after a change, so read-heavy phases walk neighbours in contiguous arrays
+    mutable bool compacted_;
+    mutable vector<int> csrOffsets_;                        // edges of node id are entries csrOffsets_[id] to csrOffsets_[id+1]-1
+    mutable vector<int> csrTargets_;                        // id of the building node at the other end of each entry
+    mutable vector<BuildingEdge*> csrEdges_;                // building edge of each entry
+    mutable vector<int> csrTypes_;                          // connector type id of each entry
+
+    // buffers of the path searches, kept between queries.  A node is seen by a search if its seen entry
+    // equals the stamp of the search, so starting a search clears nothing.
+    struct SearchSide {                                     // one direction of a bidirectional search
+        vector<unsigned> seen;
+        vector<int> parent;                                 // node the search reached each node from
+        vector<int> depth;                                  // building edges from the start of the search
+        vector<BuildingEdge*> edge;                         // building edge the search reached each node by
+        vector<int> frontier, next;                         // nodes at the current depth, and at the next
+    };
+    mutable SearchSide forward_, backward_;
+    mutable vector<long long> cost_;                        // cost of the cheapest route found to each node by cheapestRoute()
+    mutable vector<char> settled_;                          // nodes whose cheapest route is final
+    mutable vector<int> typeCost_;                          // cost of each connector type id in the current route search
+    mutable vector<pair<long long, int> > heap_;            // min-heap of (route cost, node id) for cheapestRoute()
+    mutable vector<char> onPath_;                           // nodes on the path being extended by printAllPaths()
+    mutable unsigned stamp_;
+
+    // cache of shortest-path trees, one per building node that has been the start of more than one path
+    // query, so later queries from it are answered by walking parent links, without compacting.  Adding
+    // a building edge repairs the trees by a search from the building node it brings closer; removing one
+    // repairs only the subtree below it in each tree it is part of, as no other node moves farther away.
+    struct RouteTree {
+        vector<int> depth;                                  // building edges from the start, or -1 if unreached
+        vector<int> parent;                                 // node each node is reached from
+        vector<BuildingEdge*> edge;                         // building edge each node is reached by
+        list<int>::iterator use;                            // entry of the start node id in routeUse_
+    };
+    static const size_t routeCacheLimit = 1 << 22;          // most tree entries (trees times ids) kept at once
+    mutable unordered_map<int, RouteTree> routes_;          // route tree of each start node id
+    mutable list<int> routeUse_;                            // start node ids of the route trees, most recently used first
+    mutable vector<char> queried_;                          // node ids that have been the start of a path query
+    vector<BuildingNode*> repairQueue_;                     // nodes whose depth a repair has changed
+    vector<pair<int, BuildingNode*> > repairSeeds_;         // (depth, node) of cut off nodes still reachable past the cut
 };
 
 
 // constructor -- constructs a new empty graph
-Graph::Graph() : nodes_(NULL), edges_(NULL) { }
+Graph::Graph() : nodes_(NULL), edges_(NULL), nextId_(0), edgesAdded_(0), compacted_(false), stamp_(0) { }
+
+// copy constructor -- constructs a new graph with the building nodes and edges of another graph;
+// the buildings themselves are shared, as they belong to the collection
+Graph::Graph(const Graph &graph) : nodes_(NULL), edges_(NULL), nextId_(0), edgesAdded_(0), compacted_(false), stamp_(0) {
+    copyGraph(graph);
+}
 
 // destructor -- destructs building nodes and edges in the graph
 Graph::~Graph() {
     deleteGraph();
 }
 
+// assignment operator -- replaces the building nodes and edges of object with copies of those of another graph
+Graph& Graph::operator=(const Graph &graph) {
+    if(this != &graph) {
+        deleteGraph();
+        copyGraph(graph);
+    }
+    return *this;
+}
+
+// equality operator -- returns true if both graphs hold the same buildings and, between buildings with
+// the same codes, building edges with the same connectors, in any order
+bool Graph::operator==(const Graph &graph) const {
+    BuildingNode *node1 = nodes_, *node2 = graph.nodes_;
+    for(; node1 && node2; node1 = node1->next(), node2 = node2->next()) {
+        if(node1->building() != node2->building()) {
+            return false;
+        }
+    }
+    if(node1 || node2) {
+        return false;
+    }
+    vector<string> edges[2];
+    const Graph *graphs[2] = { this, &graph };
+    for(int i = 0; i < 2; i++) {
+        for(BuildingEdge *curEdge = graphs[i]->edges_; curEdge; curEdge = curEdge->next()) {
+            string code1 = curEdge->node1() ? curEdge->node1()->building()->code() : "";
+            string code2 = curEdge->node2() ? curEdge->node2()->building()->code() : "";
+            if(code2 < code1) {
+                swap(code1, code2);
+            }
+            edges[i].push_back(code1 + '\t' + code2 + '\t' + curEdge->connector());
+        }
+        sort(edges[i].begin(), edges[i].end());
+    }
+    return edges[0] == edges[1];
+}
+
 // mutator - adds building node to the building nodes value of object
 void Graph::addNode(Building *building) {
     BuildingNode *newNode = new BuildingNode(building);
@@ -311,36 +643,67 @@ void Graph::addNode(Building *building) {
             curNode = curNode->next();
         }
         newNode->nextIs(curNode->next());
+        newNode->prevIs(curNode);
         curNode->nextIs(newNode);
     }
+    if(newNode->next()) {
+        newNode->next()->prevIs(newNode);
+    }
+    if(freeIds_.empty()) {
+        newNode->idIs(nextId_++);
+        nodesById_.push_back(newNode);
+    } else {
+        newNode->idIs(freeIds_.back());
+        freeIds_.pop_back();
+        nodesById_[newNode->id()] = newNode;
+    }
+    index_[building->bCode().packed()] = newNode;
+    compacted_ = false;
 }
 
-// mutator - removes building node from the building nodes value of object
+// mutator - removes the first building node with the building code from the building nodes value of
+// object, found through the index and unlinked through its previous building node, so the cost is
+// that of its building edges and not of the building nodes before it
 void Graph::removeNode(string code) {
-    BuildingNode *curNode = nodes_;
-    // If there are no building nodes then do nothing
-    if(curNode == NULL) {
+    BCode bCode = BCode(code);
+    BuildingNode *tempNode = findBuildingNode(code);
+    // If no building node has the building code then do nothing
+    if(tempNode == NULL) {
         return;
     }
-    // If the root building node has the building code then delete the root node
-    else if (curNode->building()->code() == code) {
-        nodes_ = curNode->next();
-        removeAdjacentEdges(curNode->building()->code());
-        delete curNode;
-    }
-    // Otherwise check other building nodes and delete the building node with the building code
-    else {
-        while(curNode->next()) {
-            if(curNode->next()->building()->code() == code) {
-                BuildingNode *tempNode = curNode->next();
-                curNode->nextIs(tempNode->next());
-                removeAdjacentEdges(tempNode->building()->code());
-                delete tempNode;
-                break;
-            }
-            curNode = curNode->next();
-        }
+    BuildingNode *nextNode = tempNode->next();
+    if(tempNode->prev()) {
+        tempNode->prev()->nextIs(nextNode);
+    } else {
+        nodes_ = nextNode;
+    }
+    if(nextNode) {
+        nextNode->prevIs(tempNode->prev());
+    }
+    removeAdjacentEdges(tempNode);
+    freeIds_.push_back(tempNode->id());
+    nodesById_[tempNode->id()] = NULL;
+    unordered_map<int, RouteTree>::iterator cached = routes_.find(tempNode->id());
+    if(cached != routes_.end()) {
+        routeUse_.erase(cached->second.use);
+        routes_.erase(cached);
+    }
+    if(tempNode->id() < (int)queried_.size()) {
+        queried_[tempNode->id()] = false;
+    }
+    delete tempNode;
+    // Nodes are sorted by building code, so other nodes with the building code come next; they lose
+    // their building edges too, since edges are removed by building code
+    BuildingNode *curNode;
+    for(curNode = nextNode; curNode && curNode->building()->bCode() == bCode; curNode = curNode->next()) {
+        removeAdjacentEdges(curNode);
+    }
+    if(nextNode && nextNode->building()->bCode() == bCode) {
+        index_[bCode.packed()] = nextNode;
+    } else {
+        index_.erase(bCode.packed());
     }
+    compacted_ = false;
 }
 
 // accessor - returns building, with the building code, of a building node in the graph
@@ -352,35 +715,99 @@ Building* Graph::findBuilding(string code) const {
     return NULL;
 }
 
-// mutator - adds building edge to the building edges value of object
+// mutator - adds building edge to the building edges value of object and to the building edges of its building nodes
 void Graph::addEdge(string code1, string code2, string connector) {
-    edges_ = new BuildingEdge(findBuildingNode(code1), findBuildingNode(code2), connector, edges_);
+    BuildingNode *node1 = findBuildingNode(code1);
+    BuildingNode *node2 = findBuildingNode(code2);
+    BuildingEdge *newEdge = new BuildingEdge(node1, node2, connector, edges_);
+    newEdge->orderIs(edgesAdded_++);
+    if(edges_) {
+        edges_->prevIs(newEdge);
+    }
+    edges_ = newEdge;
+    if(node1) {
+        node1->addEdge(newEdge);
+    }
+    if(node2 && node2 != node1) {
+        node2->addEdge(newEdge);
+    }
+    repairRoutes(newEdge);
+    compacted_ = false;
 }
 
-// mutator - remove building edge from the building edges value of object
+// mutator - removes the newest building edge that connects the buildings from the building edges value
+// of object.  Every building node with the first building code is checked, as they are adjacent in
+// nodes_; at each, the newest building edge that connects the buildings is the last one there.
 void Graph::removeEdge(string code1, string code2) {
-    BuildingEdge *curEdge = edges_;
-    // If there are no building edges then do nothing
-    if(curEdge == NULL) {
-        return;
-    }
-    // If the root building edge connects the buildings then delete the root node
-    else if (curEdge->connects(code1, code2)) {
-        edges_ = curEdge->next();
-        delete curEdge;
-    }
-    // Otherwise check other building edges and delete the building edge that connects the buildings
-    else {
-        while(curEdge->next()) {
-            if(curEdge->next()->connects(code1, code2)) {
-                BuildingEdge *tempEdge = curEdge->next();
-                curEdge->nextIs(tempEdge->next());
-                delete tempEdge;
+    BCode bCode1 = BCode(code1), bCode2 = BCode(code2);
+    BuildingEdge *newest = NULL;
+    for(BuildingNode *node = findBuildingNode(code1); node && node->building()->bCode() == bCode1; node = node->next()) {
+        const vector<BuildingEdge*> &edges = node->edges();
+        for(vector<BuildingEdge*>::size_type i = edges.size(); i > 0; i--) {
+            if(edges[i - 1]->connects(bCode1, bCode2)) {
+                if(newest == NULL || edges[i - 1]->order() > newest->order()) {
+                    newest = edges[i - 1];
+                }
                 break;
             }
-            curEdge = curEdge->next();
         }
     }
+    // If no building edge connects the buildings then do nothing
+    if(newest) {
+        unlinkEdge(newest);
+    }
+}
+
+// accessor - prints a path of building edges from the building with the first code to the building
+// with the second: with printall false, one path with the fewest building edges, read from the cached
+// route tree of the first building once it has been queried before (so the CSR arrays are only rebuilt
+// if there is no tree); with printall true, every path that visits no building twice, printed as it is found.
+void Graph::printPaths(string code1, string code2, const bool printall) const {
+    BuildingNode *node1 = findBuildingNode(code1);
+    BuildingNode *node2 = findBuildingNode(code2);
+    if(node1 == NULL || node2 == NULL) {
+        cout << "Couldn't find building " << (node1 == NULL ? code1 : code2) << endl;
+        return;
+    }
+    bool found;
+    if(printall) {
+        compact();
+        found = printAllPaths(node1->id(), node2->id());
+    } else {
+        vector<int> nodes;
+        vector<BuildingEdge*> edges;
+        found = shortestPath(node1->id(), node2->id(), nodes, edges);
+        if(found) {
+            printPath(nodes, edges);
+        }
+    }
+    if(!found) {
+        cout << "  (none)" << endl;
+    }
+    cout.flush();
+}
+
+// accessor - prints a least-cost route from the building with the first code to the building with the
+// second, where crossing a building edge costs what the route costs give its connector type and
+// excluded connector types are never crossed
+void Graph::printRoute(string code1, string code2, const RouteCosts &costs) const {
+    BuildingNode *node1 = findBuildingNode(code1);
+    BuildingNode *node2 = findBuildingNode(code2);
+    if(node1 == NULL || node2 == NULL) {
+        cout << "Couldn't find building " << (node1 == NULL ? code1 : code2) << endl;
+        return;
+    }
+    compact();
+    vector<int> nodes;
+    vector<BuildingEdge*> edges;
+    long long total;
+    if(cheapestRoute(node1->id(), node2->id(), costs, nodes, edges, total)) {
+        cout << "  cost " << total << ':' << endl;
+        printPath(nodes, edges);
+    } else {
+        cout << "  (none)" << endl;
+    }
+    cout.flush();
 }
 
 // deletes building nodes and edges values of object
@@ -395,6 +822,14 @@ void Graph::deleteGraph() {
         nodes_ = nodes_->next();
         delete tempNode;
     }
+    index_.clear();
+    freeIds_.clear();
+    nodesById_.clear();
+    nextId_ = 0;
+    routes_.clear();
+    routeUse_.clear();
+    queried_.clear();
+    compacted_ = false;
 }
 
 // TODO: remove only for debugging purposes
@@ -417,41 +852,545 @@ void Graph::printEdges() const {
     cout << endl;
 }
 
+// streaming operator -- inserts the buildings of the building nodes in order, then the buildings and
+// connector of each building edge, newest first, as printNodes() and printEdges() print them
+ostream& operator<< (ostream &sout, const Graph &g) {
+    for(BuildingNode *curNode = g.nodes_; curNode; curNode = curNode->next()) {
+        sout << *(curNode->building());
+    }
+    sout << endl;
+    for(BuildingEdge *curEdge = g.edges_; curEdge; curEdge = curEdge->next()) {
+        sout << *(curEdge->node1()->building()) << *(curEdge->node2()->building()) << curEdge->connector() << endl;
+    }
+    sout << endl;
+
+    return sout;
+}
+
+// mutator - copies the building nodes of the graph, in order and with the same ids, then its building
+// edges, oldest first, so that the copy prints, searches and removes building edges as the graph does.
+// The route trees are not copied; the copy builds its own as it is queried.
+void Graph::copyGraph(const Graph &graph) {
+    nodesById_.assign(graph.nodesById_.size(), NULL);
+    BuildingNode *lastNode = NULL;
+    for(BuildingNode *curNode = graph.nodes_; curNode; curNode = curNode->next()) {
+        BuildingNode *newNode = new BuildingNode(curNode->building());
+        newNode->idIs(curNode->id());
+        newNode->prevIs(lastNode);
+        if(lastNode) {
+            lastNode->nextIs(newNode);
+        } else {
+            nodes_ = newNode;
+        }
+        lastNode = newNode;
+        nodesById_[newNode->id()] = newNode;
+        if(index_.count(newNode->building()->bCode().packed()) == 0) {
+            index_[newNode->building()->bCode().packed()] = newNode;
+        }
+    }
+    freeIds_ = graph.freeIds_;
+    nextId_ = graph.nextId_;
+    edgesAdded_ = graph.edgesAdded_;
+
+    BuildingEdge *oldest = graph.edges_;
+    while(oldest && oldest->next()) {
+        oldest = oldest->next();
+    }
+    for(BuildingEdge *curEdge = oldest; curEdge; curEdge = curEdge->prev()) {
+        BuildingNode *node1 = curEdge->node1() ? nodesById_[curEdge->node1()->id()] : NULL;
+        BuildingNode *node2 = curEdge->node2() ? nodesById_[curEdge->node2()->id()] : NULL;
+        BuildingEdge *newEdge = new BuildingEdge(node1, node2, curEdge->connector(), edges_);
+        newEdge->orderIs(curEdge->order());
+        if(edges_) {
+            edges_->prevIs(newEdge);
+        }
+        edges_ = newEdge;
+        if(node1) {
+            node1->addEdge(newEdge);
+        }
+        if(node2 && node2 != node1) {
+            node2->addEdge(newEdge);
+        }
+    }
+    compacted_ = false;
+}
+
 // accessor - returns building node with the building code in the graph
 BuildingNode* Graph::findBuildingNode(string code) const {
-    BuildingNode *curNode = nodes_;
-    while(curNode) {
-        if(curNode->building()->code() == code) {
-            return curNode;
-        }
-        curNode = curNode->next();
+    unordered_map<unsigned long long, BuildingNode*>::const_iterator found = index_.find(BCode(code).packed());
+    if(found != index_.end()) {
+        return found->second;
     }
     return NULL;
 }
 
-// mutator - removes building edges with the building code from the building edges value of object
-void Graph::removeAdjacentEdges(string code) {
-    BuildingEdge *prev;
-    BuildingEdge *curEdge = edges_;
+// mutator - removes the building edges at the building node from the building edges value of object,
+// in time proportional to the degree of the building node and of its neighbours
+void Graph::removeAdjacentEdges(BuildingNode *node) {
+    while(!node->edges().empty()) {
+        unlinkEdge(node->edges().back());
+    }
+}
 
-    // Delete all leading building edges that have the building
-    while(curEdge && curEdge->connectsTo(code)) {
-        edges_ = curEdge->next();
-        delete curEdge;
-        curEdge = edges_;
+// mutator - unlinks the building edge from the building edges value of object and from the building
+// edges of its building nodes, then deletes it
+void Graph::unlinkEdge(BuildingEdge *edge) {
+    if(edge->prev()) {
+        edge->prev()->nextIs(edge->next());
+    } else {
+        edges_ = edge->next();
+    }
+    if(edge->next()) {
+        edge->next()->prevIs(edge->prev());
+    }
+    if(edge->node1()) {
+        edge->node1()->removeEdge(edge);
+    }
+    if(edge->node2() && edge->node2() != edge->node1()) {
+        edge->node2()->removeEdge(edge);
     }
+    cutRoutes(edge);
+    delete edge;
+    compacted_ = false;
+}
 
-    // Delete all no leading building edges with the building
-    while(curEdge) {
-        if(curEdge->connectsTo(code)) {
-            prev->nextIs(curEdge->next());
-            delete curEdge;
-            curEdge = prev->next();
-        } else {
-            prev = curEdge;
-            curEdge = curEdge->next();
+// copies the building edges at each building node into the CSR arrays, in id order, unless they are up to date
+void Graph::compact() const {
+    if(compacted_) {
+        return;
+    }
+    csrOffsets_.clear();
+    csrTargets_.clear();
+    csrEdges_.clear();
+    csrTypes_.clear();
+    for(vector<BuildingNode*>::size_type id = 0; id < nodesById_.size(); id++) {
+        csrOffsets_.push_back((int)csrEdges_.size());
+        if(nodesById_[id] == NULL) {
+            continue;
+        }
+        const vector<BuildingEdge*> &edges = nodesById_[id]->edges();
+        for(vector<BuildingEdge*>::size_type i = 0; i < edges.size(); i++) {
+            BuildingNode *other = (edges[i]->node1() == nodesById_[id]) ? edges[i]->node2() : edges[i]->node1();
+            if(other) {
+                csrTargets_.push_back(other->id());
+                csrEdges_.push_back(edges[i]);
+                csrTypes_.push_back(edges[i]->type());
+            }
+        }
+    }
+    csrOffsets_.push_back((int)csrEdges_.size());
+    compacted_ = true;
+}
+
+// grows the search buffers to the number of building nodes and moves to a new stamp, clearing the seen
+// entries only when the stamp wraps around
+void Graph::newSearch() const {
+    SearchSide *sides[] = { &forward_, &backward_ };
+    for(int s = 0; s < 2; s++) {
+        SearchSide &side = *sides[s];
+        side.seen.resize(nodesById_.size(), 0);
+        side.parent.resize(nodesById_.size());
+        side.depth.resize(nodesById_.size());
+        side.edge.resize(nodesById_.size());
+    }
+    onPath_.resize(nodesById_.size(), false);
+    cost_.resize(nodesById_.size());
+    settled_.resize(nodesById_.size());
+    if(++stamp_ == 0) {
+        fill(forward_.seen.begin(), forward_.seen.end(), 0);
+        fill(backward_.seen.begin(), backward_.seen.end(), 0);
+        stamp_ = 1;
+    }
+}
+
+// finds a path with the fewest building edges from node id source to node id target, as the node ids
+// on the path and the building edges between them.  The first query from a source is answered by a
+// search from both ends, which keeps nothing, so one-off queries neither build nor evict route trees;
+// later ones walk the route tree of the source, built on the second.  Either gives a shortest path,
+// though not always the same one.
+// RETURNS: false if no path connects the nodes
+bool Graph::shortestPath(int source, int target, vector<int> &nodes, vector<BuildingEdge*> &edges) const {
+    if(queried_.size() < nodesById_.size()) {
+        queried_.resize(nodesById_.size(), false);
+    }
+    if(!queried_[source]) {
+        queried_[source] = true;
+        compact();
+        return meetInMiddle(source, target, nodes, edges);
+    }
+    const RouteTree &tree = routeTree(source);
+    if(target >= (int)tree.depth.size() || tree.depth[target] < 0) {
+        return false;
+    }
+    nodes.clear();
+    edges.clear();
+    for(int v = target; v != source; v = tree.parent[v]) {
+        nodes.push_back(v);
+        edges.push_back(tree.edge[v]);
+    }
+    nodes.push_back(source);
+    reverse(nodes.begin(), nodes.end());
+    reverse(edges.begin(), edges.end());
+    return true;
+}
+
+// finds a path with the fewest building edges from node id source to node id target over the CSR arrays.
+// The search grows whichever side has the smaller frontier by one whole level; the best meeting point of
+// that level gives a shortest path.
+// RETURNS: false if no path connects the nodes
+bool Graph::meetInMiddle(int source, int target, vector<int> &nodes, vector<BuildingEdge*> &edges) const {
+    newSearch();
+    SearchSide *start[] = { &forward_, &backward_ };
+    int ends[] = { source, target };
+    for(int s = 0; s < 2; s++) {
+        start[s]->seen[ends[s]] = stamp_;
+        start[s]->depth[ends[s]] = 0;
+        start[s]->frontier.assign(1, ends[s]);
+    }
+
+    int meet = (source == target) ? source : -1;
+    int best = 0;
+    while(meet < 0 && !forward_.frontier.empty() && !backward_.frontier.empty()) {
+        bool forward = forward_.frontier.size() <= backward_.frontier.size();
+        SearchSide &side = forward ? forward_ : backward_;
+        SearchSide &other = forward ? backward_ : forward_;
+        side.next.clear();
+        for(vector<int>::size_type i = 0; i < side.frontier.size(); i++) {
+            int u = side.frontier[i];
+            for(int e = csrOffsets_[u]; e < csrOffsets_[u + 1]; e++) {
+                int v = csrTargets_[e];
+                if(side.seen[v] == stamp_) {
+                    continue;
+                }
+                side.seen[v] = stamp_;
+                side.parent[v] = u;
+                side.edge[v] = csrEdges_[e];
+                side.depth[v] = side.depth[u] + 1;
+                side.next.push_back(v);
+                if(other.seen[v] == stamp_ && (meet < 0 || side.depth[v] + other.depth[v] < best)) {
+                    meet = v;
+                    best = side.depth[v] + other.depth[v];
+                }
+            }
+        }
+        side.frontier.swap(side.next);
+    }
+    if(meet < 0) {
+        return false;
+    }
+
+    // Walk back from the meeting point to the source, then forward to the target
+    nodes.clear();
+    edges.clear();
+    for(int v = meet; v != source; v = forward_.parent[v]) {
+        nodes.push_back(v);
+        edges.push_back(forward_.edge[v]);
+    }
+    nodes.push_back(source);
+    reverse(nodes.begin(), nodes.end());
+    reverse(edges.begin(), edges.end());
+    for(int v = meet; v != target; v = backward_.parent[v]) {
+        nodes.push_back(backward_.parent[v]);
+        edges.push_back(backward_.edge[v]);
+    }
+    return true;
+}
+
+// accessor - returns the route tree of node id source, building it by a breadth-first search over the
+// CSR arrays, compacted first, if it is not cached.  When the cache is full the least recently used
+// trees are dropped first.
+const Graph::RouteTree& Graph::routeTree(int source) const {
+    unordered_map<int, RouteTree>::iterator found = routes_.find(source);
+    if(found != routes_.end()) {
+        routeUse_.splice(routeUse_.begin(), routeUse_, found->second.use);
+        return found->second;
+    }
+    compact();
+    while(!routes_.empty() && (routes_.size() + 1) * nodesById_.size() > routeCacheLimit) {
+        routes_.erase(routeUse_.back());
+        routeUse_.pop_back();
+    }
+    RouteTree &tree = routes_[source];
+    routeUse_.push_front(source);
+    tree.use = routeUse_.begin();
+    tree.depth.assign(nodesById_.size(), -1);
+    tree.parent.resize(nodesById_.size());
+    tree.edge.resize(nodesById_.size());
+    tree.depth[source] = 0;
+    vector<int> &frontier = forward_.frontier;
+    frontier.assign(1, source);
+    for(vector<int>::size_type i = 0; i < frontier.size(); i++) {
+        int u = frontier[i];
+        for(int e = csrOffsets_[u]; e < csrOffsets_[u + 1]; e++) {
+            int v = csrTargets_[e];
+            if(tree.depth[v] < 0) {
+                tree.depth[v] = tree.depth[u] + 1;
+                tree.parent[v] = u;
+                tree.edge[v] = csrEdges_[e];
+                frontier.push_back(v);
+            }
+        }
+    }
+    return tree;
+}
+
+// mutator - repairs each cached route tree for the new building edge.  If the edge brings its farther
+// building node closer to the start, the nodes that become closer are found by a breadth-first search
+// from it over the building edges at each node, and only they are updated.
+void Graph::repairRoutes(BuildingEdge *edge) {
+    if(routes_.empty() || edge->node1() == NULL || edge->node2() == NULL || edge->node1() == edge->node2()) {
+        return;
+    }
+    for(unordered_map<int, RouteTree>::iterator it = routes_.begin(); it != routes_.end(); ++it) {
+        RouteTree &tree = it->second;
+        if(tree.depth.size() < (vector<int>::size_type)nextId_) {
+            tree.depth.resize(nextId_, -1);
+            tree.parent.resize(nextId_);
+            tree.edge.resize(nextId_);
+        }
+        BuildingNode *near = edge->node1(), *far = edge->node2();
+        if(tree.depth[near->id()] < 0 || (tree.depth[far->id()] >= 0 && tree.depth[far->id()] < tree.depth[near->id()])) {
+            swap(near, far);
+        }
+        int depth = tree.depth[near->id()];
+        if(depth < 0 || (tree.depth[far->id()] >= 0 && tree.depth[far->id()] <= depth + 1)) {
+            continue;
+        }
+        tree.depth[far->id()] = depth + 1;
+        tree.parent[far->id()] = near->id();
+        tree.edge[far->id()] = edge;
+        repairQueue_.assign(1, far);
+        for(vector<BuildingNode*>::size_type i = 0; i < repairQueue_.size(); i++) {
+            BuildingNode *u = repairQueue_[i];
+            const vector<BuildingEdge*> &edges = u->edges();
+            for(vector<BuildingEdge*>::size_type j = 0; j < edges.size(); j++) {
+                BuildingNode *v = (edges[j]->node1() == u) ? edges[j]->node2() : edges[j]->node1();
+                if(v && (tree.depth[v->id()] < 0 || tree.depth[v->id()] > tree.depth[u->id()] + 1)) {
+                    tree.depth[v->id()] = tree.depth[u->id()] + 1;
+                    tree.parent[v->id()] = u->id();
+                    tree.edge[v->id()] = edges[j];
+                    repairQueue_.push_back(v);
+                }
+            }
+        }
+    }
+}
+
+// mutator - repairs each cached route tree that reaches a building node by the building edge, which
+// has just been taken off its building nodes.  Only the subtree below the edge can move farther from the
+// start: its nodes are found by following tree links down from the cut, then each one still reachable
+// from outside the subtree is seeded with its best depth from there, and the seeds are spread through
+// the subtree in order of depth, as a breadth-first search that starts at several depths would.
+void Graph::cutRoutes(BuildingEdge *edge) {
+    if(edge->node1() == NULL || edge->node2() == NULL) {
+        return;
+    }
+    for(unordered_map<int, RouteTree>::iterator it = routes_.begin(); it != routes_.end(); ++it) {
+        RouteTree &tree = it->second;
+        BuildingNode *cut = NULL;
+        BuildingNode *ends[] = { edge->node1(), edge->node2() };
+        for(int i = 0; i < 2; i++) {
+            int id = ends[i]->id();
+            if(id < (int)tree.depth.size() && tree.depth[id] > 0 && tree.edge[id] == edge) {
+                cut = ends[i];
+            }
+        }
+        if(cut == NULL) {
+            continue;
+        }
+
+        // Collect the subtree below the cut, then forget the depths in it
+        repairQueue_.assign(1, cut);
+        for(vector<BuildingNode*>::size_type i = 0; i < repairQueue_.size(); i++) {
+            BuildingNode *u = repairQueue_[i];
+            const vector<BuildingEdge*> &edges = u->edges();
+            for(vector<BuildingEdge*>::size_type j = 0; j < edges.size(); j++) {
+                BuildingNode *v = (edges[j]->node1() == u) ? edges[j]->node2() : edges[j]->node1();
+                if(v && tree.depth[v->id()] > 0 && tree.edge[v->id()] == edges[j] && tree.parent[v->id()] == u->id()) {
+                    repairQueue_.push_back(v);
+                }
+            }
+        }
+        for(vector<BuildingNode*>::size_type i = 0; i < repairQueue_.size(); i++) {
+            tree.depth[repairQueue_[i]->id()] = -1;
+        }
+
+        // Seed each node of the subtree with its nearest neighbour outside it
+        repairSeeds_.clear();
+        for(vector<BuildingNode*>::size_type i = 0; i < repairQueue_.size(); i++) {
+            BuildingNode *u = repairQueue_[i];
+            const vector<BuildingEdge*> &edges = u->edges();
+            for(vector<BuildingEdge*>::size_type j = 0; j < edges.size(); j++) {
+                BuildingNode *v = (edges[j]->node1() == u) ? edges[j]->node2() : edges[j]->node1();
+                if(v && tree.depth[v->id()] >= 0 && (tree.depth[u->id()] < 0 || tree.depth[u->id()] > tree.depth[v->id()] + 1)) {
+                    tree.depth[u->id()] = tree.depth[v->id()] + 1;
+                    tree.parent[u->id()] = v->id();
+                    tree.edge[u->id()] = edges[j];
+                }
+            }
+        }
+        for(vector<BuildingNode*>::size_type i = 0; i < repairQueue_.size(); i++) {
+            if(tree.depth[repairQueue_[i]->id()] >= 0) {
+                repairSeeds_.push_back(make_pair(tree.depth[repairQueue_[i]->id()], repairQueue_[i]));
+            }
+        }
+        sort(repairSeeds_.begin(), repairSeeds_.end());
+
+        // Spread the seeds, always from the shallowest node not yet spread from; a seed that was
+        // reached at a smaller depth before its turn has already been spread from
+        repairQueue_.clear();
+        vector<pair<int, BuildingNode*> >::size_type seed = 0;
+        vector<BuildingNode*>::size_type next = 0;
+        while(seed < repairSeeds_.size() || next < repairQueue_.size()) {
+            BuildingNode *u;
+            if(next == repairQueue_.size() || (seed < repairSeeds_.size() && repairSeeds_[seed].first <= tree.depth[repairQueue_[next]->id()])) {
+                u = repairSeeds_[seed].second;
+                if(tree.depth[u->id()] != repairSeeds_[seed++].first) {
+                    continue;
+                }
+            } else {
+                u = repairQueue_[next++];
+            }
+            const vector<BuildingEdge*> &edges = u->edges();
+            for(vector<BuildingEdge*>::size_type j = 0; j < edges.size(); j++) {
+                BuildingNode *v = (edges[j]->node1() == u) ? edges[j]->node2() : edges[j]->node1();
+                if(v && (tree.depth[v->id()] < 0 || tree.depth[v->id()] > tree.depth[u->id()] + 1)) {
+                    tree.depth[v->id()] = tree.depth[u->id()] + 1;
+                    tree.parent[v->id()] = u->id();
+                    tree.edge[v->id()] = edges[j];
+                    repairQueue_.push_back(v);
+                }
+            }
+        }
+    }
+}
+
+// prints every path from node id source to node id target that visits no node twice, by a depth-first
+// search on an explicit stack, so long paths cannot overflow the call stack.  Nodes that cannot reach
+// the target are pruned up front, and a path is not extended past the target.
+// RETURNS: false if no path was printed
+bool Graph::printAllPaths(int source, int target) const {
+    newSearch();
+    SearchSide &reach = backward_;
+    reach.seen[target] = stamp_;
+    reach.frontier.assign(1, target);
+    for(vector<int>::size_type i = 0; i < reach.frontier.size(); i++) {
+        int u = reach.frontier[i];
+        for(int e = csrOffsets_[u]; e < csrOffsets_[u + 1]; e++) {
+            if(reach.seen[csrTargets_[e]] != stamp_) {
+                reach.seen[csrTargets_[e]] = stamp_;
+                reach.frontier.push_back(csrTargets_[e]);
+            }
+        }
+    }
+    if(reach.seen[source] != stamp_) {
+        return false;
+    }
+
+    bool found = false;
+    vector<int> nodes(1, source);                           // the path being extended
+    vector<int> nextEntry(1, csrOffsets_[source]);          // next CSR entry to try at each node of the path
+    vector<BuildingEdge*> edges;
+    onPath_[source] = true;
+    while(!nodes.empty()) {
+        int u = nodes.back();
+        if(u == target || nextEntry.back() == csrOffsets_[u + 1]) {
+            if(u == target) {
+                printPath(nodes, edges);
+                found = true;
+            }
+            onPath_[u] = false;
+            nodes.pop_back();
+            nextEntry.pop_back();
+            if(!edges.empty()) {
+                edges.pop_back();
+            }
+            continue;
+        }
+        int e = nextEntry.back()++;
+        int v = csrTargets_[e];
+        if(onPath_[v] || reach.seen[v] != stamp_) {
+            continue;
+        }
+        onPath_[v] = true;
+        nodes.push_back(v);
+        nextEntry.push_back(csrOffsets_[v]);
+        edges.push_back(csrEdges_[e]);
+    }
+    return found;
+}
+
+// finds a least-cost route from node id source to node id target by Dijkstra's algorithm on a binary
+// heap, as the node ids on the route, the building edges between them, and the total cost.  The cost of
+// each connector type is looked up once per search, so relaxing an entry only indexes by type id.
+// Stale heap entries are skipped when popped, and the search stops once the target is settled.
+// RETURNS: false if no route avoids the excluded connector types
+bool Graph::cheapestRoute(int source, int target, const RouteCosts &costs, vector<int> &nodes, vector<BuildingEdge*> &edges, long long &total) const {
+    newSearch();
+    typeCost_.resize(ConnectorType::count());
+    for(int type = 0; type < (int)typeCost_.size(); type++) {
+        typeCost_[type] = costs.cost(type);
+    }
+    greater<pair<long long, int> > later;
+    SearchSide &side = forward_;
+    side.seen[source] = stamp_;
+    cost_[source] = 0;
+    settled_[source] = false;
+    heap_.assign(1, make_pair(0LL, source));
+    while(!heap_.empty()) {
+        pop_heap(heap_.begin(), heap_.end(), later);
+        int u = heap_.back().second;
+        long long d = heap_.back().first;
+        heap_.pop_back();
+        if(settled_[u] || d != cost_[u]) {
+            continue;
         }
+        settled_[u] = true;
+        if(u == target) {
+            break;
+        }
+        for(int e = csrOffsets_[u]; e < csrOffsets_[u + 1]; e++) {
+            int c = typeCost_[csrTypes_[e]];
+            if(c < 0) {
+                continue;
+            }
+            int v = csrTargets_[e];
+            if(side.seen[v] != stamp_ || (!settled_[v] && d + c < cost_[v])) {
+                side.seen[v] = stamp_;
+                settled_[v] = false;
+                cost_[v] = d + c;
+                side.parent[v] = u;
+                side.edge[v] = csrEdges_[e];
+                heap_.push_back(make_pair(cost_[v], v));
+                push_heap(heap_.begin(), heap_.end(), later);
+            }
+        }
+    }
+    if(side.seen[target] != stamp_ || !settled_[target]) {
+        return false;
+    }
+
+    // Walk back from the target to the source
+    total = cost_[target];
+    nodes.clear();
+    edges.clear();
+    for(int v = target; v != source; v = side.parent[v]) {
+        nodes.push_back(v);
+        edges.push_back(side.edge[v]);
     }
+    nodes.push_back(source);
+    reverse(nodes.begin(), nodes.end());
+    reverse(edges.begin(), edges.end());
+    return true;
+}
+
+// prints the building codes of the nodes on one line, each pair joined by the connector of its building edge
+void Graph::printPath(const vector<int> &nodes, const vector<BuildingEdge*> &edges) const {
+    cout << "  " << nodesById_[nodes[0]]->building()->code();
+    for(vector<BuildingEdge*>::size_type i = 0; i < edges.size(); i++) {
+        cout << " --" << edges[i]->connector() << "-- " << nodesById_[nodes[i + 1]]->building()->code();
+    }
+    cout << '\n';
 }
 
 
@@ -460,7 +1399,7 @@ void Graph::removeAdjacentEdges(string code) {
 //************************************************************************
 
 //  test-harness operators
-enum Op { NONE, mapPtr, building, wreckage, findB, node, remNode, edge, remEdge, delGraph, copyGraph, assignGraph, eq, path, print };
+enum Op { NONE, mapPtr, building, wreckage, findB, node, remNode, edge, remEdge, delGraph, copyGraph, assignGraph, eq, path, route, print };
 
 Op convertOp( string opStr ) {
     switch( opStr[0] ) {
@@ -477,6 +1416,7 @@ Op convertOp( string opStr ) {
         case 'a': return assignGraph;
         case 'q': return eq;
         case 'p': return path;
+        case 'o': return route;
         case 'g': return print;
         default: {
             return NONE;
@@ -680,44 +1620,70 @@ int main( int argc, char *argv[] ) {
                 break;
             }
 
-//                // check whether map1 is equal to map2
-//            case eq: {
-//                if ( map1 == map2 ) {
-//                    cout << "Maps 1 and 2 are equal." << endl;
-//                }
-//                else {
-//                    cout << "Maps 1 and 2 are NOT equal." << endl;
-//                }
-//                break;
-//            }
-//
-//                // graph copy constructor
-//            case copyGraph: {
-//                Graph map3( *map );
-//                cout << map3;
-//                string junk;
-//                getline( cin, junk );
-//                break;
-//            }
-//
-//                // graph assignment operator
-//            case assignGraph: {
-//                map1 = map2;
-//                cout << map1;
-//                break;
-//            }
-//
-//                // find path(s) in graph from one building to another building
-//            case path: {
-//                string code1, code2, all;
-//                cin >> code1 >> code2 >> all;
-//                cout << "Paths from " << code1 << " to " << code2 << " are: " << endl;
-//                bool printall = ( all.length() > 0 && all.at(0) == 't' ) ? true : false;
-//                map->printPaths( code1, code2, printall );
-//                string junk;
-//                getline( cin, junk );
-//                break;
-//            }
+                // check whether map1 is equal to map2
+            case eq: {
+                if ( map1 == map2 ) {
+                    cout << "Maps 1 and 2 are equal." << endl;
+                }
+                else {
+                    cout << "Maps 1 and 2 are NOT equal." << endl;
+                }
+                break;
+            }
+
+                // graph copy constructor
+            case copyGraph: {
+                Graph map3( *map );
+                cout << map3;
+                string junk;
+                getline( cin, junk );
+                break;
+            }
+
+                // graph assignment operator
+            case assignGraph: {
+                map1 = map2;
+                cout << map1;
+                break;
+            }
+
+                // find path(s) in graph from one building to another building
+            case path: {
+                string code1, code2, all;
+                cin >> code1 >> code2 >> all;
+                cout << "Paths from " << code1 << " to " << code2 << " are: " << endl;
+                bool printall = ( all.length() > 0 && all.at(0) == 't' ) ? true : false;
+                map->printPaths( code1, code2, printall );
+                string junk;
+                getline( cin, junk );
+                break;
+            }
+
+                // find a least-cost route in graph from one building to another building.  The rest of the line
+                // sets connector costs as connector=cost, or connector=x to exclude the connector; * stands for
+                // every connector without a cost of its own.  Every connector costs 1 by default.
+            case route: {
+                string code1, code2, line, setting;
+                cin >> code1 >> code2;
+                getline( cin, line );
+                RouteCosts costs;
+                istringstream settings( line );
+                while ( settings >> setting ) {
+                    string::size_type eqPos = setting.find( '=' );
+                    string connector = setting.substr( 0, eqPos );
+                    string value = ( eqPos == string::npos ) ? "" : setting.substr( eqPos + 1 );
+                    int cost = ( value.empty() || value[0] == 'x' ) ? -1 : atoi( value.c_str() );
+                    if ( connector == "*" ) {
+                        costs.defaultCostIs( cost );
+                    }
+                    else {
+                        costs.costIs( connector, cost );
+                    }
+                }
+                cout << "Route from " << code1 << " to " << code2 << " is: " << endl;
+                map->printRoute( code1, code2, costs );
+                break;
+            }
 
             default: {
                 cerr << "Invalid command." << endl;